@@ -17,6 +17,7 @@
 #include "ec.h"
 #include "error.h"
 #include "lru.h"
+#include "move.h"
 #include "recovery.h"
 #include "trace.h"
 #include "varint.h"
@@ -1779,10 +1780,18 @@ void bch2_do_discards(struct bch_fs *c)
 		bch2_write_ref_put(c, BCH_WRITE_REF_discard);
 }
 
+/*
+ * Invalidating a bucket whose cached data is still partly hot: the first time
+ * we see it we stop and return its LRU entry in @rescue, so that the caller can
+ * move the hot extents out first (this can't be done with our btree_trans in
+ * use) and then resume the walk from that entry; when we get back to it,
+ * *rescue is the same entry and the bucket is invalidated as normal.
+ */
 static int invalidate_one_bucket(struct btree_trans *trans,
 				 struct btree_iter *lru_iter,
 				 struct bkey_s_c lru_k,
-				 s64 *nr_to_invalidate)
+				 s64 *nr_to_invalidate,
+				 struct bpos *rescue)
 {
 	struct bch_fs *c = trans->c;
 	struct btree_iter alloc_iter = { NULL };
@@ -1817,6 +1826,16 @@ static int invalidate_one_bucket(struct btree_trans *trans,
 	if (!a->v.cached_sectors)
 		bch_err(c, "invalidating empty bucket, confused");
 
+	if (!bpos_eq(lru_iter->pos, *rescue)) {
+		ret = bch2_bucket_has_hot_cached(trans, bucket, a->v.gen);
+		if (ret < 0)
+			goto out;
+		if (ret) {
+			*rescue = lru_iter->pos;
+			goto out;
+		}
+	}
+
 	cached_sectors = a->v.cached_sectors;
 
 	SET_BCH_ALLOC_V4_NEED_INC_GEN(&a->v, false);
@@ -1876,17 +1895,37 @@ static void bch2_do_invalidates_work(struct work_struct *work)
 	for_each_member_device(c, ca) {
 		s64 nr_to_invalidate =
 			should_invalidate_buckets(ca, bch2_dev_usage_read(ca));
+		struct bpos start = lru_pos(ca->dev_idx, 0, 0);
+		struct bpos rescued = POS_MAX, rescue;
+again:
+		rescue = rescued;
 
 		ret = for_each_btree_key_upto(trans, iter, BTREE_ID_lru,
-				lru_pos(ca->dev_idx, 0, 0),
+				start,
 				lru_pos(ca->dev_idx, U64_MAX, LRU_TIME_MAX),
 				BTREE_ITER_INTENT, k,
-			invalidate_one_bucket(trans, &iter, k, &nr_to_invalidate));
+			invalidate_one_bucket(trans, &iter, k, &nr_to_invalidate, &rescue));
 
 		if (ret < 0) {
 			percpu_ref_put(&ca->ref);
 			break;
 		}
+
+		if (!bpos_eq(rescue, rescued)) {
+			bch2_trans_put(trans);
+			ret = bch2_bucket_rescue_hot_cached(c, u64_to_bucket(rescue.offset));
+			bch_err_msg(c, ret, "moving hot extents out of cached bucket");
+			trans = bch2_trans_get(c);
+
+			/*
+			 * Resume from the bucket we just rescued, not from the
+			 * start: the walk only moves forwards through the LRU,
+			 * so it can't keep bouncing between hot buckets:
+			 */
+			start	= rescue;
+			rescued	= rescue;
+			goto again;
+		}
 	}
 err:
 	bch2_trans_put(trans);
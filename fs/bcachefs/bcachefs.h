@@ -187,6 +187,7 @@
 #include <linux/bug.h>
 #include <linux/bio.h>
 #include <linux/closure.h>
+#include <linux/hashtable.h>
 #include <linux/kobject.h>
 #include <linux/list.h>
 #include <linux/math64.h>
@@ -458,8 +459,10 @@ enum bch_time_stats {
 #include "buckets_types.h"
 #include "buckets_waiting_for_journal_types.h"
 #include "clock_types.h"
+#include "dirent_cache_types.h"
 #include "disk_groups_types.h"
 #include "ec_types.h"
+#include "inode_types.h"
 #include "journal_types.h"
 #include "keylist_types.h"
 #include "quota_types.h"
@@ -506,6 +509,7 @@ enum gc_phase {
 	GC_PHASE_BTREE_logged_ops,
 	GC_PHASE_BTREE_rebalance_work,
 	GC_PHASE_BTREE_subvolume_children,
+	GC_PHASE_BTREE_reflink_drops,
 
 	GC_PHASE_PENDING_DELETE,
 };
@@ -520,6 +524,8 @@ struct reflink_gc {
 	u64		offset;
 	u32		size;
 	u32		refcount;
+	/* references dropped but not yet applied, from BTREE_ID_reflink_drops */
+	u32		pending;
 };
 
 typedef GENRADIX(struct reflink_gc) reflink_gc_table;
@@ -655,6 +661,11 @@ struct bch_fs_pcpu {
 	u64			sectors_available;
 };
 
+/* Per numa node pool of free space for disk reservations: */
+struct bch_fs_sectors_node {
+	atomic64_t		sectors_available;
+} ____cacheline_aligned_in_smp;
+
 struct journal_seq_blacklist_table {
 	size_t			nr;
 	struct journal_seq_blacklist_table_entry {
@@ -703,6 +714,8 @@ struct btree_trans_buf {
 	x(stripe_create)						\
 	x(stripe_delete)						\
 	x(reflink)							\
+	x(reflink_drops)						\
+	x(inode_rm)							\
 	x(fallocate)							\
 	x(discard)							\
 	x(invalidate)							\
@@ -758,6 +771,7 @@ struct bch_fs {
 	struct bch_dev __rcu	*devs[BCH_SB_MEMBERS_MAX];
 
 	struct bch_replicas_cpu replicas;
+	struct bch_replicas_hash replicas_hash;
 	struct bch_replicas_cpu replicas_gc;
 	struct mutex		replicas_gc_lock;
 	mempool_t		replicas_delta_pool;
@@ -896,6 +910,9 @@ struct bch_fs {
 
 	atomic64_t		sectors_available;
 	struct mutex		sectors_available_lock;
+	/* incremented each time sectors_available is recalculated: */
+	unsigned		sectors_available_seq;
+	struct bch_fs_sectors_node *sectors_available_node;
 
 	struct bch_fs_pcpu __percpu	*pcpu;
 
@@ -906,6 +923,7 @@ struct bch_fs {
 	struct bch_fs_usage __percpu	*usage[JOURNAL_BUF_NR];
 	struct bch_fs_usage __percpu	*usage_gc;
 	u64 __percpu		*online_reserved;
+	struct bch_fs_usage_cache	usage_cache;
 
 	/* single element mempool: */
 	struct mutex		usage_scratch_lock;
@@ -980,6 +998,11 @@ struct bch_fs {
 	struct bucket_nocow_lock_table
 				nocow_locks;
 	struct rhashtable	promote_table;
+	u8			*promote_filter;
+	atomic_t		promote_filter_reads;
+	u64			*promote_streams;
+	u8			*cache_heat;
+	atomic_t		cache_heat_reads;
 
 	mempool_t		compression_bounce[2];
 	mempool_t		compress_workspace[BCH_COMPRESSION_TYPE_NR];
@@ -989,6 +1012,10 @@ struct bch_fs {
 	struct crypto_shash	*sha256;
 	struct crypto_sync_skcipher *chacha20;
 	struct crypto_shash	*poly1305;
+	/* same key as @chacha20, as cpu endian words for the chacha library: */
+	u32			chacha20_key[8];
+	/* for encrypting and decrypting large bios in parallel: */
+	struct workqueue_struct	*crypt_wq;
 
 	atomic64_t		key_version;
 
@@ -998,6 +1025,10 @@ struct bch_fs {
 	struct list_head	moving_context_list;
 	struct mutex		moving_context_lock;
 
+	/* moves whose read is in flight, that other moves may piggyback on: */
+	spinlock_t		move_coalesce_lock;
+	DECLARE_HASHTABLE(move_coalesce_table, 8);
+
 	/* REBALANCE */
 	struct bch_fs_rebalance	rebalance;
 
@@ -1008,6 +1039,7 @@ struct bch_fs {
 	s64			copygc_wait;
 	bool			copygc_running;
 	wait_queue_head_t	copygc_running_wq;
+	struct bch_move_progress copygc_progress;
 
 	/* STRIPES: */
 	GENRADIX(struct stripe) stripes;
@@ -1038,6 +1070,9 @@ struct bch_fs {
 	reflink_gc_table	reflink_gc_table;
 	size_t			reflink_gc_nr;
 
+	atomic64_t		reflink_drop_seq;
+	struct work_struct	reflink_drops_work;
+
 	/* fs.c */
 	struct list_head	vfs_inodes_list;
 	struct mutex		vfs_inodes_lock;
@@ -1078,9 +1113,23 @@ struct bch_fs {
 	struct btree_node	*verify_ondisk;
 	struct mutex		verify_lock;
 
-	u64			*unused_inode_hints;
+#ifdef CONFIG_BCACHEFS_TESTS
+	/* one line per perf test run, for debugfs: */
+	struct mutex		perf_test_lock;
+	struct printbuf		perf_test_results;
+#endif
+
+	struct inode_alloc_shard *inode_alloc;
 	unsigned		inode_shard_bits;
 
+	/* unlinked inodes being deleted in the background: */
+	struct mutex		inode_rm_lock;
+	DARRAY(subvol_inum)	inode_rm_pending;
+	subvol_inum		inode_rm_cur;
+	struct work_struct	inode_rm_work;
+
+	struct dirent_cache	dirent_cache;
+
 	/*
 	 * A btree node on disk could have too many bsets for an iterator to fit
 	 * on the stack - have to dynamically allocate them
@@ -1103,8 +1152,11 @@ struct bch_fs {
 	unsigned		btree_gc_periodic:1;
 	unsigned		copy_gc_enabled:1;
 	bool			promote_whole_extents;
+	unsigned		promote_min_reads;
+	unsigned		cache_hot_reads;
 
 	struct time_stats	times[BCH_TIME_STAT_NR];
+	struct time_stats	btree_node_read_times[BTREE_ID_NR];
 
 	struct btree_transaction_stats btree_transaction_stats[BCH_TRANSACTIONS_NR];
 
@@ -85,10 +85,13 @@ struct bch_ioctl_incremental {
 
 #define BCH_IOCTL_FSCK_OFFLINE	_IOW(0xbc,	19,  struct bch_ioctl_fsck_offline)
 #define BCH_IOCTL_FSCK_ONLINE	_IOW(0xbc,	20,  struct bch_ioctl_fsck_online)
+#define BCH_IOCTL_BACKGROUND_PROGRESS _IOWR(0xbc, 21, struct bch_ioctl_background_progress)
+#define BCH_IOCTL_TIME_STATS_HIST _IOWR(0xbc,	22, struct bch_ioctl_time_stats_hist)
 
 /* ioctl below act on a particular file, not the filesystem as a whole: */
 
 #define BCHFS_IOC_REINHERIT_ATTRS	_IOR(0xbc, 64, const char __user *)
+#define BCHFS_IOC_CREATE_BATCH		_IOWR(0xbc, 65, struct bch_ioctl_create_batch)
 
 /*
  * BCH_IOCTL_QUERY_UUID: get filesystem UUID
@@ -196,11 +199,22 @@ enum bch_data_ops {
  * BCH_IOCTL_DATA: operations that walk and manipulate filesystem data (e.g.
  * scrub, rereplicate, migrate).
  *
+ * BCH_DATA_OP_scrub reads every replica (and erasure coded parity block) on
+ * device @scrub.dev in physical order and verifies checksums; bad replicas are
+ * rewritten from a good copy if one exists. @start_pos/@end_pos are ignored.
+ *
+ * With BCH_DATA_PHYSICAL_ORDER, BCH_DATA_OP_migrate walks the buckets of
+ * @migrate.dev in order and finds the data in each bucket via backpointers,
+ * instead of walking the extents btree from @start_pos to @end_pos; reads from
+ * the device being evacuated are then close to sequential.
+ *
  * This ioctl kicks off a job in the background, and returns a file descriptor.
  * Reading from the file descriptor returns a struct bch_ioctl_data_event,
  * indicating current progress, and closing the file descriptor will stop the
  * job. The file descriptor is O_CLOEXEC.
  */
+#define BCH_DATA_PHYSICAL_ORDER		(1U << 0)
+
 struct bch_ioctl_data {
 	__u16			op;
 	__u8			start_btree;
@@ -215,6 +229,10 @@ struct bch_ioctl_data {
 		__u32		dev;
 		__u32		pad;
 	}			migrate;
+	struct {
+		__u32		dev;
+		__u32		rate;	/* sectors/sec, 0 for unlimited */
+	}			scrub;
 	struct {
 		__u64		pad[8];
 	};
@@ -235,6 +253,10 @@ struct bch_ioctl_data_progress {
 
 	__u64			sectors_done;
 	__u64			sectors_total;
+
+	/* scrub: */
+	__u64			sectors_error_corrected;
+	__u64			sectors_error_uncorrected;
 } __packed __aligned(8);
 
 struct bch_ioctl_data_event {
@@ -409,4 +431,153 @@ struct bch_ioctl_fsck_online {
 	__u64			opts;		/* string */
 };
 
+/*
+ * BCH_IOCTL_BACKGROUND_PROGRESS: query how much work background data movement
+ * (rebalance and copygc) has outstanding, and how long it's expected to take
+ *
+ * @flags		- in: must be 0; out: BCH_BACKGROUND_PROGRESS_PARTIAL if
+ *			  there was too much pending work to count all of it,
+ *			  in which case the rebalance totals are lower bounds
+ * @inum		- if nonzero, only count rebalance work for this inode
+ * @nr_targets		- in: size of @targets; out: number of targets with
+ *			  pending rebalance work (may be larger than the size
+ *			  passed in, in which case @targets was truncated)
+ * @scans_pending	- number of pending rebalance scans: data they'll find
+ *			  isn't known until the scan runs, and isn't included
+ *			  in @rebalance.sectors_pending
+ * @rebalance, @copygc	- per job totals:
+ *	@sectors_pending	- sectors waiting to be moved; for copygc, this
+ *				  is the amount of fragmented space on rw
+ *				  devices
+ *	@sectors_done		- sectors moved since the filesystem went rw
+ *	@rate			- recent throughput, in sectors per second
+ *	@eta			- estimated seconds until @sectors_pending is
+ *				  done at @rate, or U64_MAX if unknown
+ * @targets		- rebalance work broken out by the target the data is
+ *			  being moved to; target 0 means data that's being
+ *			  rewritten for other reasons (e.g. compression)
+ *
+ * Work queued in the last few moments may not be counted yet.
+ */
+#define BCH_BACKGROUND_PROGRESS_PARTIAL		(1U << 0)
+
+struct bch_ioctl_background_progress_job {
+	__u64			sectors_pending;
+	__u64			sectors_done;
+	__u64			rate;
+	__u64			eta;
+};
+
+struct bch_ioctl_background_progress_target {
+	__u32			target;
+	__u32			pad;
+	__u64			sectors_pending;
+};
+
+struct bch_ioctl_background_progress {
+	__u32			flags;
+	__u32			nr_targets;
+	__u64			inum;
+	__u64			scans_pending;
+
+	struct bch_ioctl_background_progress_job rebalance;
+	struct bch_ioctl_background_progress_job copygc;
+
+	struct bch_ioctl_background_progress_target targets[];
+};
+
+/*
+ * Latency histograms: log-linear, with 2^@sub_bits linear buckets per power of
+ * two nanoseconds. Bucket i counts durations from
+ *
+ *	i < 2^sub_bits:	i
+ *	otherwise:	(2^sub_bits + (i & (2^sub_bits - 1))) << ((i >> sub_bits) - 1)
+ *
+ * up to the start of bucket i + 1; the last bucket also counts everything
+ * longer.
+ *
+ * @kind and @idx select the histogram: for BCH_TIME_HIST_fs, @idx is one of the
+ * time stats in the filesystem's sysfs time_stats directory, in the order
+ * they're listed there; for dev_read/dev_write, a device index; for
+ * btree_node_read, a btree ID.
+ *
+ * The debugfs file time_stats_hist returns every enabled histogram as a
+ * sequence of struct bch_time_stats_hist_header, each followed by
+ * @nr_buckets __u64s.
+ */
+#define BCH_TIME_HIST_KINDS()		\
+	x(fs,			0)	\
+	x(dev_read,		1)	\
+	x(dev_write,		2)	\
+	x(btree_node_read,	3)
+
+enum bch_time_hist_kind {
+#define x(t, n) BCH_TIME_HIST_##t = n,
+	BCH_TIME_HIST_KINDS()
+#undef x
+	BCH_TIME_HIST_NR
+};
+
+struct bch_time_stats_hist_header {
+	__u8			kind;
+	__u8			sub_bits;
+	__u16			idx;
+	__u32			nr_buckets;
+	char			name[32];
+};
+
+/*
+ * BCH_IOCTL_TIME_STATS_HIST: read a latency histogram
+ *
+ * Histograms cost percpu memory and are only recorded once enabled, either by
+ * passing BCH_TIME_HIST_ENABLE (which enables all of them) or by writing 1 to
+ * time_stats/histograms in sysfs; returns -ENOENT if not enabled.
+ *
+ * @h		- in: @kind, @idx, and @nr_buckets as the size of @buckets;
+ *		  out: the rest, and @nr_buckets as the number of buckets in
+ *		  the histogram (which may be more than were returned)
+ * @buckets	- pointer to array of __u64
+ */
+#define BCH_TIME_HIST_ENABLE		(1U << 0)
+
+struct bch_ioctl_time_stats_hist {
+	__u32			flags;
+	__u32			pad;
+	struct bch_time_stats_hist_header h;
+	__u64			buckets;
+};
+
+/*
+ * BCHFS_IOC_CREATE_BATCH: create many regular files in the directory the ioctl
+ * is issued on, with as few btree transactions as possible
+ *
+ * @flags	- must be 0
+ * @nr		- number of entries in @entries, at most BCH_CREATE_BATCH_MAX
+ * @nr_created	- returned: number of entries that were created; on error,
+ *		  exactly the first @nr_created entries exist
+ * @entries	- pointer to array of struct bch_ioctl_create_batch_entry
+ *
+ * Each entry may optionally carry file contents, which are stored inline in
+ * the same transaction as the inode and dirent; @data_len must then be no
+ * larger than the filesystem's inline data limit (half a block, max 1024
+ * bytes), and the inline_data option must be enabled.
+ */
+struct bch_ioctl_create_batch_entry {
+	__u64			name_ptr;
+	__u64			data_ptr;
+	__u32			data_len;
+	__u16			name_len;
+	__u16			mode;
+};
+
+struct bch_ioctl_create_batch {
+	__u32			flags;
+	__u32			nr;
+	__u32			nr_created;
+	__u32			pad;
+	__u64			entries;
+};
+
+#define BCH_CREATE_BATCH_MAX		1024
+
 #endif /* _BCACHEFS_IOCTL_H */
@@ -1289,6 +1289,8 @@ static int bch2_gc_done(struct bch_fs *c,
 			copy_fs_field(fs_usage_replicas_wrong,
 				      replicas[i], "%s", buf.buf);
 		}
+
+		bch2_fs_usage_cache_invalidate(c);
 	}
 
 #undef copy_fs_field
@@ -1579,23 +1581,26 @@ static int bch2_gc_write_reflink_key(struct btree_trans *trans,
 		return -EINVAL;
 	}
 
-	if (fsck_err_on(r->refcount != le64_to_cpu(*refcount), c,
+	/* Dropped references that haven't been applied yet are still counted: */
+	u64 expected = (u64) r->refcount + r->pending;
+
+	if (fsck_err_on(expected != le64_to_cpu(*refcount), c,
 			reflink_v_refcount_wrong,
 			"reflink key has wrong refcount:\n"
 			"  %s\n"
-			"  should be %u",
+			"  should be %llu",
 			(bch2_bkey_val_to_text(&buf, c, k), buf.buf),
-			r->refcount)) {
+			expected)) {
 		struct bkey_i *new = bch2_bkey_make_mut(trans, iter, &k, 0);
 
 		ret = PTR_ERR_OR_ZERO(new);
 		if (ret)
 			return ret;
 
-		if (!r->refcount)
+		if (!expected)
 			new->k.type = KEY_TYPE_deleted;
 		else
-			*bkey_refcount(bkey_i_to_s(new)) = cpu_to_le64(r->refcount);
+			*bkey_refcount(bkey_i_to_s(new)) = cpu_to_le64(expected);
 	}
 fsck_err:
 	printbuf_exit(&buf);
@@ -1646,9 +1651,31 @@ static int bch2_gc_reflink_start(struct bch_fs *c,
 			r->offset	= k.k->p.offset;
 			r->size		= k.k->size;
 			r->refcount	= 0;
+			r->pending	= 0;
 			0;
 		})));
 
+	if (!ret && bch2_reflink_drops_deferred(c))
+		ret = bch2_trans_run(c,
+			for_each_btree_key(trans, iter, BTREE_ID_reflink_drops, POS_MIN,
+					   BTREE_ITER_PREFETCH, k, ({
+				if (k.k->type != KEY_TYPE_reflink_drop)
+					continue;
+
+				struct bkey_s_c_reflink_drop d = bkey_s_c_to_reflink_drop(k);
+				u64 start	= le64_to_cpu(d.v->start);
+				u64 end		= le64_to_cpu(d.v->end);
+				struct reflink_gc *r;
+
+				for (size_t i = bch2_reflink_gc_idx(c, start);
+				     i < c->reflink_gc_nr &&
+				     (r = genradix_ptr(&c->reflink_gc_table, i)) &&
+				     r->offset - r->size < end;
+				     i++)
+					r->pending++;
+				0;
+			})));
+
 	bch_err_fn(c, ret);
 	return ret;
 }
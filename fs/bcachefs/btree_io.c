@@ -1324,6 +1324,9 @@ static void btree_node_read_work(struct work_struct *work)
 
 	time_stats_update(&c->times[BCH_TIME_btree_node_read],
 			       rb->start_time);
+	if (b->c.btree_id < BTREE_ID_NR)
+		time_stats_update(&c->btree_node_read_times[b->c.btree_id],
+				  rb->start_time);
 	bio_put(&rb->bio);
 
 	if (saw_error && !btree_node_read_error(b)) {
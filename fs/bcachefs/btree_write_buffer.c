@@ -9,6 +9,7 @@
 #include "journal.h"
 #include "journal_io.h"
 #include "journal_reclaim.h"
+#include "reflink.h"
 
 #include <linux/prefetch.h>
 
@@ -249,7 +250,7 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans)
 	struct btree_write_buffer *wb = &c->btree_write_buffer;
 	struct btree_iter iter = { NULL };
 	size_t skipped = 0, fast = 0, slowpath = 0;
-	bool write_locked = false;
+	bool write_locked = false, reflink_drops = false;
 	int ret = 0;
 
 	bch2_trans_unlock(trans);
@@ -290,6 +291,8 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans)
 
 		BUG_ON(!k->journal_seq);
 
+		reflink_drops |= i->btree == BTREE_ID_reflink_drops;
+
 		if (i + 1 < &darray_top(wb->sorted) &&
 		    wb_key_eq(i, i + 1)) {
 			struct btree_write_buffered_key *n = &wb->flushing.keys.data[i[1].idx];
@@ -382,6 +385,10 @@ static int bch2_btree_write_buffer_flush_locked(struct btree_trans *trans)
 	trace_write_buffer_flush(trans, wb->flushing.keys.nr, skipped, fast, 0);
 	bch2_journal_pin_drop(j, &wb->flushing.pin);
 	wb->flushing.keys.nr = 0;
+
+	/* Deferred reflink refcount drops are applied once they're in the btree: */
+	if (!ret && reflink_drops)
+		bch2_do_reflink_drops(c);
 	return ret;
 }
 
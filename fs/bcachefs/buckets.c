@@ -72,6 +72,8 @@ void bch2_fs_usage_initialize(struct bch_fs *c)
 	}
 
 	percpu_up_write(&c->mark_lock);
+
+	bch2_fs_usage_cache_invalidate(c);
 }
 
 static inline struct bch_dev_usage *dev_usage_ptr(struct bch_dev *ca,
@@ -233,37 +235,108 @@ u64 bch2_fs_sectors_used(struct bch_fs *c, struct bch_fs_usage_online *fs_usage)
 		   c->capacity);
 }
 
+/*
+ * statfs() may see usage that is up to this old; reservations always recompute
+ * from the percpu counters:
+ */
+#define FS_USAGE_CACHE_MAX_AGE		(HZ / 10)
+
+static void bch2_fs_usage_base_read(struct bch_fs *c, struct bch_fs_usage_base *b)
+{
+	unsigned i, seq, u64s = sizeof(*b) / sizeof(u64);
+
+	percpu_rwsem_assert_held(&c->mark_lock);
+
+	do {
+		seq = read_seqcount_begin(&c->usage_lock);
+		*b = c->usage_base->b;
+
+		for (i = 0; i < ARRAY_SIZE(c->usage); i++)
+			acc_u64s_percpu((u64 *) b, (u64 __percpu *) c->usage[i], u64s);
+	} while (read_seqcount_retry(&c->usage_lock, seq));
+}
+
 static struct bch_fs_usage_short
-__bch2_fs_usage_read_short(struct bch_fs *c)
+fs_usage_base_to_short(struct bch_fs *c, struct bch_fs_usage_base *b,
+		       u64 online_reserved)
 {
 	struct bch_fs_usage_short ret;
 	u64 data, reserved;
 
-	ret.capacity = c->capacity -
-		bch2_fs_usage_read_one(c, &c->usage_base->b.hidden);
+	ret.capacity	= c->capacity - b->hidden;
 
-	data		= bch2_fs_usage_read_one(c, &c->usage_base->b.data) +
-		bch2_fs_usage_read_one(c, &c->usage_base->b.btree);
-	reserved	= bch2_fs_usage_read_one(c, &c->usage_base->b.reserved) +
-		percpu_u64_get(c->online_reserved);
+	data		= b->data + b->btree;
+	reserved	= b->reserved + online_reserved;
 
 	ret.used	= min(ret.capacity, data + reserve_factor(reserved));
 	ret.free	= ret.capacity - ret.used;
 
-	ret.nr_inodes	= bch2_fs_usage_read_one(c, &c->usage_base->b.nr_inodes);
+	ret.nr_inodes	= b->nr_inodes;
 
 	return ret;
 }
 
+static struct bch_fs_usage_short
+__bch2_fs_usage_read_short(struct bch_fs *c)
+{
+	struct bch_fs_usage_cache *cache = &c->usage_cache;
+	struct bch_fs_usage_base b;
+	u64 online_reserved;
+
+	bch2_fs_usage_base_read(c, &b);
+	online_reserved = percpu_u64_get(c->online_reserved);
+
+	write_seqlock(&cache->lock);
+	cache->b		= b;
+	cache->online_reserved	= online_reserved;
+	cache->updated		= jiffies;
+	cache->valid		= true;
+	write_sequnlock(&cache->lock);
+
+	return fs_usage_base_to_short(c, &b, online_reserved);
+}
+
+void bch2_fs_usage_cache_invalidate(struct bch_fs *c)
+{
+	write_seqlock(&c->usage_cache.lock);
+	c->usage_cache.valid = false;
+	write_sequnlock(&c->usage_cache.lock);
+}
+
+/*
+ * Returns usage from the cache if it's fresh enough; otherwise one thread
+ * refreshes it while everyone else keeps using the old copy:
+ */
 struct bch_fs_usage_short
 bch2_fs_usage_read_short(struct bch_fs *c)
 {
+	struct bch_fs_usage_cache *cache = &c->usage_cache;
 	struct bch_fs_usage_short ret;
+	struct bch_fs_usage_base b;
+	u64 online_reserved;
+	unsigned long updated;
+	bool valid;
+	unsigned seq;
+
+	do {
+		seq = read_seqbegin(&cache->lock);
+		b		= cache->b;
+		online_reserved	= cache->online_reserved;
+		updated		= cache->updated;
+		valid		= cache->valid;
+	} while (read_seqretry(&cache->lock, seq));
+
+	if (unlikely(!valid))
+		mutex_lock(&cache->refresh_lock);
+	else if (likely(time_before(jiffies, updated + FS_USAGE_CACHE_MAX_AGE)) ||
+		 !mutex_trylock(&cache->refresh_lock))
+		return fs_usage_base_to_short(c, &b, online_reserved);
 
 	percpu_down_read(&c->mark_lock);
 	ret = __bch2_fs_usage_read_short(c);
 	percpu_up_read(&c->mark_lock);
 
+	mutex_unlock(&cache->refresh_lock);
 	return ret;
 }
 
@@ -1265,50 +1338,105 @@ int bch2_trans_mark_dev_sbs(struct bch_fs *c)
 
 /* Disk reservations: */
 
-#define SECTORS_CACHE	1024
+/*
+ * Free space for disk reservations is kept in a hierarchy of pools: per cpu
+ * (see bch2_disk_reservation_add()), per numa node, and c->sectors_available.
+ * Each level is refilled from the one above it in batches, without taking
+ * any locks.
+ *
+ * Batch sizes shrink as the filesystem fills up, so that when we're close to
+ * full we aren't stranding free space in the per cpu and per node caches, and
+ * don't have to recalculate as often.
+ *
+ * Only when the global pool is exhausted do we recalculate free space from
+ * filesystem usage. That's serialized, but writers that were waiting on another
+ * thread's recalculation just retry the pools.
+ */
+
+#define SECTORS_CACHE_MAX	4096
+
+static unsigned sectors_cache_batch(struct bch_fs *c)
+{
+	return min_t(u64, SECTORS_CACHE_MAX,
+		     div_u64(atomic64_read(&c->sectors_available),
+			     num_online_cpus() * 16));
+}
+
+/* Take between @min and @want sectors from @v, or nothing: */
+static u64 sectors_pool_get(atomic64_t *v, u64 min, u64 want)
+{
+	u64 old, get, cur = atomic64_read(v);
+
+	do {
+		old = cur;
+		get = min(want, old);
+		if (get < min)
+			return 0;
+	} while ((cur = atomic64_cmpxchg(v, old, old - get)) != old);
+
+	return get;
+}
 
 int __bch2_disk_reservation_add(struct bch_fs *c, struct disk_reservation *res,
 			      u64 sectors, int flags)
 {
+	atomic64_t *node = &c->sectors_available_node[numa_node_id()].sectors_available;
 	struct bch_fs_pcpu *pcpu;
-	u64 old, v, get;
+	u64 cpu_batch, node_batch, get, extra;
 	s64 sectors_available;
+	unsigned seq, i;
 	int ret;
+retry:
+	seq = READ_ONCE(c->sectors_available_seq);
 
-	percpu_down_read(&c->mark_lock);
 	preempt_disable();
 	pcpu = this_cpu_ptr(c->pcpu);
-
-	if (sectors <= pcpu->sectors_available)
+	if (sectors <= pcpu->sectors_available) {
+		pcpu->sectors_available -= sectors;
+		preempt_enable();
 		goto out;
+	}
+	preempt_enable();
 
-	v = atomic64_read(&c->sectors_available);
-	do {
-		old = v;
-		get = min((u64) sectors + SECTORS_CACHE, old);
+	cpu_batch	= sectors_cache_batch(c);
+	node_batch	= cpu_batch * DIV_ROUND_UP(num_online_cpus(), num_online_nodes());
 
-		if (get < sectors) {
-			preempt_enable();
-			goto recalculate;
-		}
-	} while ((v = atomic64_cmpxchg(&c->sectors_available,
-				       old, old - get)) != old);
+	get = sectors_pool_get(node, sectors, sectors + cpu_batch);
+	if (get) {
+		this_cpu_add(c->pcpu->sectors_available, get - sectors);
+		goto out;
+	}
 
-	pcpu->sectors_available		+= get;
+	get = sectors_pool_get(&c->sectors_available, sectors,
+			       sectors + cpu_batch + node_batch);
+	if (get) {
+		extra = min(get - sectors, cpu_batch);
+		this_cpu_add(c->pcpu->sectors_available, extra);
+		atomic64_add(get - sectors - extra, node);
+		goto out;
+	}
 
+	goto recalculate;
 out:
-	pcpu->sectors_available		-= sectors;
 	this_cpu_add(*c->online_reserved, sectors);
 	res->sectors			+= sectors;
-
-	preempt_enable();
-	percpu_up_read(&c->mark_lock);
 	return 0;
 
 recalculate:
 	mutex_lock(&c->sectors_available_lock);
 
+	if (READ_ONCE(c->sectors_available_seq) != seq) {
+		/* Someone else recalculated while we were waiting: */
+		mutex_unlock(&c->sectors_available_lock);
+		goto retry;
+	}
+
+	percpu_down_read(&c->mark_lock);
+
 	percpu_u64_set(&c->pcpu->sectors_available, 0);
+	for (i = 0; i < nr_node_ids; i++)
+		atomic64_set(&c->sectors_available_node[i].sectors_available, 0);
+
 	sectors_available = avail_factor(__bch2_fs_usage_read_short(c).free);
 
 	if (sectors <= sectors_available ||
@@ -1323,8 +1451,10 @@ int __bch2_disk_reservation_add(struct bch_fs *c, struct disk_reservation *res,
 		ret = -BCH_ERR_ENOSPC_disk_reservation;
 	}
 
-	mutex_unlock(&c->sectors_available_lock);
+	WRITE_ONCE(c->sectors_available_seq, seq + 1);
+
 	percpu_up_read(&c->mark_lock);
+	mutex_unlock(&c->sectors_available_lock);
 
 	return ret;
 }
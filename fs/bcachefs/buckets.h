@@ -299,6 +299,8 @@ void bch2_fs_usage_to_text(struct printbuf *,
 
 u64 bch2_fs_sectors_used(struct bch_fs *, struct bch_fs_usage_online *);
 
+void bch2_fs_usage_cache_invalidate(struct bch_fs *);
+
 struct bch_fs_usage_short
 bch2_fs_usage_read_short(struct bch_fs *);
 
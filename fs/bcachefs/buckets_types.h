@@ -54,6 +54,19 @@ struct bch_fs_usage_base {
 	u64			nr_inodes;
 };
 
+/*
+ * Summed copy of the base fs usage counters, so that statfs() and friends
+ * don't have to sum percpu counters on every call:
+ */
+struct bch_fs_usage_cache {
+	seqlock_t		lock;
+	struct mutex		refresh_lock;
+	bool			valid;
+	unsigned long		updated;
+	u64			online_reserved;
+	struct bch_fs_usage_base b;
+};
+
 struct bch_fs_usage {
 	/* all fields are in units of 512 byte sectors: */
 	struct bch_fs_usage_base b;
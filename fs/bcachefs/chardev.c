@@ -7,6 +7,7 @@
 #include "chardev.h"
 #include "journal.h"
 #include "move.h"
+#include "rebalance.h"
 #include "recovery.h"
 #include "replicas.h"
 #include "super.h"
@@ -439,8 +440,19 @@ static ssize_t bch2_data_job_read(struct file *file, char __user *buf,
 		.p.pos			= ctx->stats.pos.pos,
 		.p.sectors_done		= atomic64_read(&ctx->stats.sectors_seen),
 		.p.sectors_total	= bch2_fs_usage_read_short(c).used,
+		.p.sectors_error_corrected = atomic64_read(&ctx->stats.sectors_error_corrected),
+		.p.sectors_error_uncorrected = atomic64_read(&ctx->stats.sectors_error_uncorrected),
 	};
 
+	if (ctx->arg.op == BCH_DATA_OP_scrub) {
+		struct bch_dev_usage u = bch2_dev_usage_read(bch_dev_bkey_exists(c, ctx->arg.scrub.dev));
+
+		e.p.sectors_total = 0;
+		for (unsigned i = 0; i < BCH_DATA_NR; i++)
+			if (i != BCH_DATA_btree && i != BCH_DATA_cached)
+				e.p.sectors_total += u.d[i].sectors;
+	}
+
 	if (len < sizeof(e))
 		return -EINVAL;
 
@@ -462,7 +474,14 @@ static long bch2_ioctl_data(struct bch_fs *c,
 	if (!capable(CAP_SYS_ADMIN))
 		return -EPERM;
 
-	if (arg.op >= BCH_DATA_OP_NR || arg.flags)
+	if (arg.op >= BCH_DATA_OP_NR ||
+	    (arg.flags & ~BCH_DATA_PHYSICAL_ORDER) ||
+	    (arg.flags && arg.op != BCH_DATA_OP_migrate))
+		return -EINVAL;
+
+	if (arg.op == BCH_DATA_OP_scrub &&
+	    (arg.scrub.dev >= c->sb.nr_devices ||
+	     !bch2_dev_exists2(c, arg.scrub.dev)))
 		return -EINVAL;
 
 	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
@@ -597,6 +616,85 @@ static long bch2_ioctl_dev_usage(struct bch_fs *c,
 	return copy_to_user_errcode(user_arg, &arg, sizeof(arg));
 }
 
+static long bch2_ioctl_background_progress(struct bch_fs *c,
+				struct bch_ioctl_background_progress __user *user_arg)
+{
+	struct bch_ioctl_background_progress arg;
+	struct bch_background_progress p = {};
+	int ret;
+
+	if (copy_from_user(&arg, user_arg, sizeof(arg)))
+		return -EFAULT;
+
+	if (arg.flags)
+		return -EINVAL;
+
+	p.inum = arg.inum;
+
+	ret = bch2_background_progress(c, &p);
+	if (ret)
+		goto err;
+
+	arg.flags		= p.flags;
+	arg.scans_pending	= p.scans_pending;
+	arg.rebalance		= p.rebalance;
+	arg.copygc		= p.copygc;
+
+	for (unsigned i = 0; i < min_t(u32, arg.nr_targets, p.targets.nr); i++) {
+		ret = copy_to_user_errcode(&user_arg->targets[i], &p.targets.data[i],
+					   sizeof(p.targets.data[i]));
+		if (ret)
+			goto err;
+	}
+
+	arg.nr_targets = p.targets.nr;
+
+	ret = copy_to_user_errcode(user_arg, &arg, sizeof(arg));
+err:
+	darray_exit(&p.targets);
+	return ret;
+}
+
+static long bch2_ioctl_time_stats_hist(struct bch_fs *c,
+				struct bch_ioctl_time_stats_hist __user *user_arg)
+{
+	struct bch_ioctl_time_stats_hist arg;
+	u64 *buckets;
+	int ret;
+
+	if (copy_from_user(&arg, user_arg, sizeof(arg)))
+		return -EFAULT;
+
+	if ((arg.flags & ~BCH_TIME_HIST_ENABLE) || arg.pad)
+		return -EINVAL;
+
+	if (arg.flags & BCH_TIME_HIST_ENABLE) {
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+
+		ret = bch2_fs_time_stats_hist_enable(c);
+		if (ret)
+			return ret;
+	}
+
+	buckets = kvmalloc_array(TIME_STATS_HIST_NR, sizeof(*buckets), GFP_KERNEL);
+	if (!buckets)
+		return -ENOMEM;
+
+	u32 nr = arg.h.nr_buckets;
+
+	ret = bch2_fs_time_stats_hist_read(c, &arg.h, buckets);
+	if (ret)
+		goto err;
+
+	ret = copy_to_user_errcode((void __user *)(unsigned long) arg.buckets, buckets,
+				   sizeof(*buckets) * min(nr, arg.h.nr_buckets)) ?:
+		copy_to_user_errcode(user_arg, &arg, sizeof(arg));
+err:
+	kvfree(buckets);
+	return ret;
+}
+
 static long bch2_ioctl_dev_usage_v2(struct bch_fs *c,
 				 struct bch_ioctl_dev_usage_v2 __user *user_arg)
 {
@@ -905,6 +1003,12 @@ long bch2_fs_ioctl(struct bch_fs *c, unsigned cmd, void __user *arg)
 		BCH_IOCTL(disk_resize_journal, struct bch_ioctl_disk_resize_journal);
 	case BCH_IOCTL_FSCK_ONLINE:
 		BCH_IOCTL(fsck_online, struct bch_ioctl_fsck_online);
+	case BCH_IOCTL_BACKGROUND_PROGRESS:
+		ret = bch2_ioctl_background_progress(c, arg);
+		goto out;
+	case BCH_IOCTL_TIME_STATS_HIST:
+		ret = bch2_ioctl_time_stats_hist(c, arg);
+		goto out;
 	default:
 		return -ENOTTY;
 	}
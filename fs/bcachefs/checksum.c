@@ -318,6 +318,163 @@ struct bch_csum bch2_checksum_bio(struct bch_fs *c, unsigned type,
 	return __bch2_checksum_bio(c, type, nonce, bio, &iter);
 }
 
+/*
+ * Fused chacha20/poly1305, with the chacha and poly1305 library routines (which
+ * use SIMD implementations where available):
+ *
+ * The MAC is always of the ciphertext, so when encrypting we MAC each segment
+ * after encrypting it, and when decrypting before - either way while it's
+ * still in cache, so we only make one pass over the data.
+ */
+struct chacha20_stream {
+	u32			state[CHACHA_STATE_WORDS];
+	/* keystream left over from a partial block: */
+	u8			ks[CHACHA_BLOCK_SIZE];
+	unsigned		ks_used;
+};
+
+static void chacha20_stream_init(struct bch_fs *c, struct chacha20_stream *s,
+				 struct nonce nonce)
+{
+	chacha_init(s->state, c->chacha20_key, (void *) nonce.d);
+	s->ks_used = CHACHA_BLOCK_SIZE;
+}
+
+static void chacha20_stream_crypt(struct chacha20_stream *s, u8 *p, unsigned len)
+{
+	unsigned full;
+
+	while (len && s->ks_used < CHACHA_BLOCK_SIZE) {
+		*p++ ^= s->ks[s->ks_used++];
+		len--;
+	}
+
+	full = round_down(len, CHACHA_BLOCK_SIZE);
+	if (full)
+		chacha20_crypt(s->state, p, p, full);
+	p	+= full;
+	len	-= full;
+
+	if (len) {
+		memset(s->ks, 0, sizeof(s->ks));
+		chacha20_crypt(s->state, s->ks, s->ks, sizeof(s->ks));
+
+		for (s->ks_used = 0; s->ks_used < len; s->ks_used++)
+			p[s->ks_used] ^= s->ks[s->ks_used];
+	}
+}
+
+/*
+ * Large bios are split into chunks that are encrypted or decrypted in parallel
+ * on c->crypt_wq, each with the nonce advanced to the chunk's offset in the
+ * bio. The caller does the first chunk itself and waits for the rest, so
+ * completion is ordered the same as the synchronous path.
+ *
+ * Chunks have to be big enough for the chacha20 work saved to outweigh queueing
+ * the work and, when checksumming, the extra poly1305 pass over the data. A bio
+ * is only split if it's at least two chunks, i.e. 256k - well above the default
+ * encoded_extent_max, so normal sized encrypted extents always take the single
+ * pass path:
+ */
+#define BCH_CRYPT_CHUNK_MIN	(128U << 10)
+#define BCH_CRYPT_CHUNKS_MAX	8
+
+struct crypt_chunk {
+	struct work_struct	work;
+	struct bch_fs		*c;
+	struct bio		*bio;
+	struct bvec_iter	iter;
+	struct nonce		nonce;
+	struct closure		*cl;
+};
+
+static void crypt_chunk(struct crypt_chunk *chunk)
+{
+	struct chacha20_stream s;
+	struct bvec_iter iter;
+	struct bio_vec bv;
+
+	chacha20_stream_init(chunk->c, &s, chunk->nonce);
+
+	__bio_for_each_segment(bv, chunk->bio, iter, chunk->iter) {
+		void *p = kmap_local_page(bv.bv_page) + bv.bv_offset;
+
+		chacha20_stream_crypt(&s, p, bv.bv_len);
+		kunmap_local(p);
+	}
+
+	memzero_explicit(&s, sizeof(s));
+}
+
+static void crypt_chunk_work(struct work_struct *work)
+{
+	struct crypt_chunk *chunk = container_of(work, struct crypt_chunk, work);
+
+	crypt_chunk(chunk);
+	closure_put(chunk->cl);
+}
+
+static unsigned crypt_bio_nr_chunks(struct bch_fs *c, struct bio *bio)
+{
+	return c->crypt_wq
+		? min3(bio->bi_iter.bi_size / BCH_CRYPT_CHUNK_MIN,
+		       BCH_CRYPT_CHUNKS_MAX,
+		       num_online_cpus())
+		: 0;
+}
+
+static void bch2_crypt_bio_parallel(struct bch_fs *c, struct nonce nonce,
+				    struct bio *bio, unsigned nr)
+{
+	unsigned bytes = bio->bi_iter.bi_size;
+	unsigned chunk_bytes, offset = 0, i;
+	struct crypt_chunk *chunks;
+	struct bvec_iter iter = bio->bi_iter;
+	struct closure cl;
+
+	chunks = kmalloc_array(nr, sizeof(*chunks), GFP_NOFS|__GFP_NOWARN);
+	if (!chunks) {
+		struct crypt_chunk chunk = {
+			.c	= c,
+			.bio	= bio,
+			.iter	= bio->bi_iter,
+			.nonce	= nonce,
+		};
+
+		crypt_chunk(&chunk);
+		return;
+	}
+
+	chunk_bytes = round_up(DIV_ROUND_UP(bytes, nr), PAGE_SIZE);
+	closure_init_stack(&cl);
+
+	for (i = 0; i < nr && iter.bi_size; i++) {
+		chunks[i] = (struct crypt_chunk) {
+			.c	= c,
+			.bio	= bio,
+			.iter	= iter,
+			.nonce	= nonce_add(nonce, offset),
+			.cl	= &cl,
+		};
+		chunks[i].iter.bi_size = min(chunk_bytes, iter.bi_size);
+
+		bio_advance_iter(bio, &iter, chunks[i].iter.bi_size);
+		offset += chunks[i].iter.bi_size;
+	}
+	nr = i;
+
+	for (i = 1; i < nr; i++) {
+		closure_get(&cl);
+		INIT_WORK(&chunks[i].work, crypt_chunk_work);
+		queue_work(c->crypt_wq, &chunks[i].work);
+	}
+
+	crypt_chunk(&chunks[0]);
+	closure_sync(&cl);
+
+	kfree(chunks);
+}
+
 int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 		     struct nonce nonce, struct bio *bio)
 {
@@ -325,11 +482,18 @@ int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 	struct bvec_iter iter;
 	struct scatterlist sgl[16], *sg = sgl;
 	size_t bytes = 0;
+	unsigned nr_chunks;
 	int ret = 0;
 
 	if (!bch2_csum_type_is_encryption(type))
 		return 0;
 
+	nr_chunks = crypt_bio_nr_chunks(c, bio);
+	if (nr_chunks > 1) {
+		bch2_crypt_bio_parallel(c, nonce, bio, nr_chunks);
+		return 0;
+	}
+
 	sg_init_table(sgl, ARRAY_SIZE(sgl));
 
 	bio_for_each_segment(bv, bio, iter) {
@@ -355,6 +519,62 @@ int __bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 	return do_encrypt_sg(c->chacha20, nonce, sgl, bytes);
 }
 
+struct bch_csum __bch2_crypt_checksum_bio(struct bch_fs *c, unsigned type,
+					  struct nonce nonce, struct bio *bio,
+					  bool encrypt)
+{
+	struct chacha20_stream s;
+	struct poly1305_desc_ctx poly;
+	u8 poly_key[POLY1305_KEY_SIZE] = { 0 };
+	u8 digest[POLY1305_DIGEST_SIZE];
+	struct bch_csum ret = { 0 };
+	struct bio_vec bv;
+	struct bvec_iter iter;
+	unsigned nr_chunks = crypt_bio_nr_chunks(c, bio);
+
+	BUG_ON(!bch2_csum_type_is_encryption(type));
+
+	/*
+	 * poly1305 can't be split up, but for large bios it's still faster to
+	 * spread the chacha20 work across CPUs and MAC in a separate pass:
+	 */
+	if (nr_chunks > 1) {
+		if (encrypt)
+			bch2_crypt_bio_parallel(c, nonce, bio, nr_chunks);
+		ret = bch2_checksum_bio(c, type, nonce, bio);
+		if (!encrypt)
+			bch2_crypt_bio_parallel(c, nonce, bio, nr_chunks);
+		return ret;
+	}
+
+	/* same as gen_poly_key(): */
+	nonce.d[3] ^= BCH_NONCE_POLY;
+	chacha20_stream_init(c, &s, nonce);
+	chacha20_stream_crypt(&s, poly_key, sizeof(poly_key));
+	nonce.d[3] ^= BCH_NONCE_POLY;
+
+	poly1305_init(&poly, poly_key);
+	chacha20_stream_init(c, &s, nonce);
+
+	bio_for_each_segment(bv, bio, iter) {
+		void *p = kmap_local_page(bv.bv_page) + bv.bv_offset;
+
+		if (!encrypt)
+			poly1305_update(&poly, p, bv.bv_len);
+		chacha20_stream_crypt(&s, p, bv.bv_len);
+		if (encrypt)
+			poly1305_update(&poly, p, bv.bv_len);
+		kunmap_local(p);
+	}
+
+	poly1305_final(&poly, digest);
+	memcpy(&ret, digest, bch_crc_bytes[type]);
+
+	memzero_explicit(&s, sizeof(s));
+	memzero_explicit(poly_key, sizeof(poly_key));
+	return ret;
+}
+
 struct bch_csum bch2_checksum_merge(unsigned type, struct bch_csum a,
 				    struct bch_csum b, size_t b_len)
 {
@@ -645,6 +865,20 @@ int bch2_decrypt_sb_key(struct bch_fs *c,
 	return ret;
 }
 
+static int bch2_set_chacha20_key(struct bch_fs *c, struct bch_key *key)
+{
+	int ret = crypto_skcipher_setkey(&c->chacha20->base,
+					 (void *) key, sizeof(*key));
+	if (ret)
+		return ret;
+
+	BUILD_BUG_ON(sizeof(c->chacha20_key) != CHACHA_KEY_SIZE);
+
+	for (unsigned i = 0; i < ARRAY_SIZE(c->chacha20_key); i++)
+		c->chacha20_key[i] = get_unaligned_le32((void *) key + i * sizeof(u32));
+	return 0;
+}
+
 static int bch2_alloc_ciphers(struct bch_fs *c)
 {
 	int ret;
@@ -735,8 +969,7 @@ int bch2_enable_encryption(struct bch_fs *c, bool keyed)
 			goto err;
 	}
 
-	ret = crypto_skcipher_setkey(&c->chacha20->base,
-			(void *) &key.key, sizeof(key.key));
+	ret = bch2_set_chacha20_key(c, &key.key);
 	if (ret)
 		goto err;
 
@@ -761,6 +994,11 @@ int bch2_enable_encryption(struct bch_fs *c, bool keyed)
 
 void bch2_fs_encryption_exit(struct bch_fs *c)
 {
+	memzero_explicit(c->chacha20_key, sizeof(c->chacha20_key));
+
+	if (c->crypt_wq)
+		destroy_workqueue(c->crypt_wq);
+
 	if (!IS_ERR_OR_NULL(c->poly1305))
 		crypto_free_shash(c->poly1305);
 	if (!IS_ERR_OR_NULL(c->chacha20))
@@ -790,12 +1028,18 @@ int bch2_fs_encryption_init(struct bch_fs *c)
 	if (ret)
 		goto out;
 
+	c->crypt_wq = alloc_workqueue("bcachefs_crypt",
+				      WQ_UNBOUND|WQ_MEM_RECLAIM, 0);
+	if (!c->crypt_wq) {
+		ret = -BCH_ERR_ENOMEM_crypt_wq;
+		goto out;
+	}
+
 	ret = bch2_decrypt_sb_key(c, crypt, &key);
 	if (ret)
 		goto out;
 
-	ret = crypto_skcipher_setkey(&c->chacha20->base,
-			(void *) &key.key, sizeof(key.key));
+	ret = bch2_set_chacha20_key(c, &key);
 	if (ret)
 		goto out;
 out:
@@ -97,6 +97,30 @@ static inline int bch2_encrypt_bio(struct bch_fs *c, unsigned type,
 		: 0;
 }
 
+struct bch_csum __bch2_crypt_checksum_bio(struct bch_fs *, unsigned,
+					  struct nonce, struct bio *, bool);
+
+/*
+ * Equivalent to bch2_encrypt_bio() followed by bch2_checksum_bio(), but for
+ * encrypted checksum types only makes one pass over the data:
+ */
+static inline struct bch_csum bch2_encrypt_checksum_bio(struct bch_fs *c, unsigned type,
+							struct nonce nonce, struct bio *bio)
+{
+	return bch2_csum_type_is_encryption(type)
+		? __bch2_crypt_checksum_bio(c, type, nonce, bio, true)
+		: bch2_checksum_bio(c, type, nonce, bio);
+}
+
+/* Equivalent to bch2_checksum_bio() followed by bch2_encrypt_bio(): */
+static inline struct bch_csum bch2_checksum_decrypt_bio(struct bch_fs *c, unsigned type,
+							struct nonce nonce, struct bio *bio)
+{
+	return bch2_csum_type_is_encryption(type)
+		? __bch2_crypt_checksum_bio(c, type, nonce, bio, false)
+		: bch2_checksum_bio(c, type, nonce, bio);
+}
+
 extern const struct bch_sb_field_ops bch_sb_field_ops_crypt;
 
 int bch2_decrypt_sb_key(struct bch_fs *, struct bch_sb_field_crypt *,
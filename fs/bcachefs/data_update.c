@@ -97,6 +97,7 @@ static int __bch2_data_update_index_update(struct btree_trans *trans,
 		container_of(op, struct data_update, op);
 	struct keylist *keys = &op->insert_keys;
 	struct bkey_buf _new, _insert;
+	bool updated = false;
 	int ret = 0;
 
 	bch2_bkey_buf_init(&_new);
@@ -295,6 +296,7 @@ static int __bch2_data_update_index_update(struct btree_trans *trans,
 				m->data_opts.btree_insert_flags);
 		if (!ret) {
 			bch2_btree_iter_set_pos(&iter, next_pos);
+			updated = true;
 
 			this_cpu_add(c->counters[BCH_COUNTER_move_extent_finish], new->k.size);
 			trace_move_extent_finish2(c, bkey_i_to_s_c(&new->k_i));
@@ -325,6 +327,24 @@ static int __bch2_data_update_index_update(struct btree_trans *trans,
 		goto next;
 	}
 out:
+	if (updated && m->data_opts.rescue)
+		count_event(c, cached_extent_rescue);
+
+	if (updated && m->data_opts.scrub && m->stats) {
+		struct bkey_s_c old = bkey_i_to_s_c(m->k.k);
+		const union bch_extent_entry *entry;
+		struct extent_ptr_decoded p;
+		unsigned i = 0;
+
+		/* same units as scrub_key(): on disk sectors of the bad replica */
+		bkey_for_each_ptr_decode(old.k, bch2_bkey_ptrs_c(old), p, entry) {
+			if ((1U << i) & m->data_opts.rewrite_ptrs)
+				atomic64_add(p.crc.compressed_size,
+					     &m->stats->sectors_error_corrected);
+			i++;
+		}
+	}
+
 	bch2_trans_iter_exit(trans, &iter);
 	bch2_bkey_buf_exit(&_insert, c);
 	bch2_bkey_buf_exit(&_new, c);
@@ -15,6 +15,10 @@ struct data_update_opts {
 	u8		extra_replicas;
 	unsigned	btree_insert_flags;
 	unsigned	write_flags;
+	/* rewriting a replica that failed scrub: count it as corrected */
+	bool		scrub;
+	/* copying hot data out of a cached bucket before it's invalidated */
+	bool		rescue;
 };
 
 struct data_update {
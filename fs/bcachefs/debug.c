@@ -20,6 +20,7 @@
 #include "fsck.h"
 #include "inode.h"
 #include "super.h"
+#include "tests.h"
 
 #include <linux/console.h>
 #include <linux/debugfs.h>
@@ -866,6 +867,144 @@ void bch2_fs_debug_exit(struct bch_fs *c)
 		debugfs_remove_recursive(c->fs_debug_dir);
 }
 
+/*
+ * time_stats_hist: every enabled latency histogram, in the binary format
+ * described in bcachefs_ioctl.h; the snapshot is taken at open time:
+ */
+struct time_stats_hist_dump {
+	size_t			size;
+	u8			data[];
+};
+
+static int time_stats_hist_add(struct bch_fs *c, struct time_stats_hist_dump *d,
+			       size_t bytes, unsigned kind, unsigned idx)
+{
+	struct bch_time_stats_hist_header h = { .kind = kind, .idx = idx };
+	size_t entry_bytes = sizeof(h) + sizeof(u64) * TIME_STATS_HIST_NR;
+
+	if (d->size + entry_bytes > bytes)
+		return -ENOSPC;
+
+	int ret = bch2_fs_time_stats_hist_read(c, &h,
+				(u64 *) (d->data + d->size + sizeof(h)));
+	if (ret)
+		return bch2_err_matches(ret, ENOENT) ? 0 : ret;
+
+	memcpy(d->data + d->size, &h, sizeof(h));
+	d->size += entry_bytes;
+	return 0;
+}
+
+static int time_stats_hist_open(struct inode *inode, struct file *file)
+{
+	struct bch_fs *c = inode->i_private;
+	unsigned nr = BCH_TIME_STAT_NR + BTREE_ID_NR + c->sb.nr_devices * 2;
+	size_t bytes = nr * (sizeof(struct bch_time_stats_hist_header) +
+			     sizeof(u64) * TIME_STATS_HIST_NR);
+	struct time_stats_hist_dump *d;
+	int ret = 0;
+
+	d = kvzalloc(sizeof(*d) + bytes, GFP_KERNEL);
+	if (!d)
+		return -ENOMEM;
+
+	for (unsigned i = 0; i < BCH_TIME_STAT_NR && !ret; i++)
+		ret = time_stats_hist_add(c, d, bytes, BCH_TIME_HIST_fs, i);
+	for (unsigned i = 0; i < c->sb.nr_devices && !ret; i++)
+		ret =   time_stats_hist_add(c, d, bytes, BCH_TIME_HIST_dev_read, i) ?:
+			time_stats_hist_add(c, d, bytes, BCH_TIME_HIST_dev_write, i);
+	for (unsigned i = 0; i < BTREE_ID_NR && !ret; i++)
+		ret = time_stats_hist_add(c, d, bytes, BCH_TIME_HIST_btree_node_read, i);
+
+	if (ret) {
+		kvfree(d);
+		return ret;
+	}
+
+	file->private_data = d;
+	return 0;
+}
+
+static int time_stats_hist_release(struct inode *inode, struct file *file)
+{
+	kvfree(file->private_data);
+	return 0;
+}
+
+static ssize_t time_stats_hist_dump_read(struct file *file, char __user *buf,
+					 size_t size, loff_t *ppos)
+{
+	struct time_stats_hist_dump *d = file->private_data;
+
+	return simple_read_from_buffer(buf, size, ppos, d->data, d->size);
+}
+
+static const struct file_operations time_stats_hist_ops = {
+	.owner		= THIS_MODULE,
+	.open		= time_stats_hist_open,
+	.release	= time_stats_hist_release,
+	.read		= time_stats_hist_dump_read,
+};
+
+#ifdef CONFIG_BCACHEFS_TESTS
+/* perf_test_results: reading snapshots the results, writing clears them */
+static int perf_test_results_open(struct inode *inode, struct file *file)
+{
+	struct bch_fs *c = inode->i_private;
+	struct dump_iter *i;
+
+	i = kzalloc(sizeof(struct dump_iter), GFP_KERNEL);
+	if (!i)
+		return -ENOMEM;
+
+	i->c	= c;
+	i->buf	= PRINTBUF;
+	file->private_data = i;
+
+	if (file->f_mode & FMODE_READ) {
+		bch2_perf_test_results_to_text(&i->buf, c);
+		if (i->buf.allocation_failure) {
+			printbuf_exit(&i->buf);
+			kfree(i);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static ssize_t perf_test_results_read(struct file *file, char __user *buf,
+				      size_t size, loff_t *ppos)
+{
+	struct dump_iter *i = file->private_data;
+	ssize_t ret;
+
+	i->ubuf = buf;
+	i->size	= size;
+	i->ret	= 0;
+
+	ret = flush_buf(i);
+	return ret < 0 ? ret : i->ret;
+}
+
+static ssize_t perf_test_results_write(struct file *file, const char __user *buf,
+				       size_t size, loff_t *ppos)
+{
+	struct dump_iter *i = file->private_data;
+
+	bch2_perf_test_results_reset(i->c);
+	return size;
+}
+
+static const struct file_operations perf_test_results_ops = {
+	.owner		= THIS_MODULE,
+	.open		= perf_test_results_open,
+	.release	= bch2_dump_release,
+	.read		= perf_test_results_read,
+	.write		= perf_test_results_write,
+};
+#endif
+
 void bch2_fs_debug_init(struct bch_fs *c)
 {
 	struct btree_debug *bd;
@@ -894,6 +1033,14 @@ void bch2_fs_debug_init(struct bch_fs *c)
 	debugfs_create_file("btree_deadlock", 0400, c->fs_debug_dir,
 			    c->btree_debug, &btree_deadlock_ops);
 
+	debugfs_create_file("time_stats_hist", 0400, c->fs_debug_dir,
+			    c, &time_stats_hist_ops);
+
+#ifdef CONFIG_BCACHEFS_TESTS
+	debugfs_create_file("perf_test_results", 0600, c->fs_debug_dir,
+			    c, &perf_test_results_ops);
+#endif
+
 	c->btree_debug_dir = debugfs_create_dir("btrees", c->fs_debug_dir);
 	if (IS_ERR_OR_NULL(c->btree_debug_dir))
 		return;
@@ -12,6 +12,7 @@
 #include "subvolume.h"
 
 #include <linux/dcache.h>
+#include <linux/sort.h>
 
 static unsigned bch2_dirent_name_bytes(struct bkey_s_c_dirent d)
 {
@@ -37,13 +38,8 @@ struct qstr bch2_dirent_get_name(struct bkey_s_c_dirent d)
 static u64 bch2_dirent_hash(const struct bch_hash_info *info,
 			    const struct qstr *name)
 {
-	struct bch_str_hash_ctx ctx;
-
-	bch2_str_hash_init(&ctx, info);
-	bch2_str_hash_update(&ctx, info, name->name, name->len);
-
 	/* [0,2) reserved for dots */
-	return max_t(u64, bch2_str_hash_end(&ctx, info), 2);
+	return max_t(u64, bch2_str_hash(info, name->name, name->len), 2);
 }
 
 static u64 dirent_hash_key(const struct bch_hash_info *info, const void *key)
@@ -538,6 +534,70 @@ int bch2_empty_dir_trans(struct btree_trans *trans, subvol_inum dir)
 		bch2_empty_dir_snapshot(trans, dir.inum, snapshot);
 }
 
+#define READDIR_PREFETCH_NR	64
+
+static int u64_cmp(const void *_l, const void *_r)
+{
+	const u64 *l = _l, *r = _r;
+
+	return cmp_int(*l, *r);
+}
+
+/*
+ * readdir is usually followed by a stat() of every entry; dirents are in hash
+ * order, so those inode lookups would be random lookups in the inodes btree.
+ *
+ * Instead, look ahead at the next READDIR_PREFETCH_NR dirents and look up the
+ * inodes they point to in inode number order, pulling them into the btree key
+ * cache (or at least the btree node cache): @end is set to the first dirent
+ * offset not covered.
+ */
+static int bch2_readdir_prefetch_inodes(struct btree_trans *trans, u64 dir,
+					u32 snapshot, u64 pos, u64 *end)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	u64 inums[READDIR_PREFETCH_NR];
+	unsigned i, nr = 0;
+	int ret;
+
+	*end = U64_MAX;
+
+	for_each_btree_key_upto_norestart(trans, iter, BTREE_ID_dirents,
+			   SPOS(dir, pos, snapshot),
+			   POS(dir, U64_MAX), 0, k, ret) {
+		if (nr == ARRAY_SIZE(inums)) {
+			*end = k.k->p.offset;
+			break;
+		}
+
+		if (k.k->type != KEY_TYPE_dirent)
+			continue;
+
+		struct bkey_s_c_dirent d = bkey_s_c_to_dirent(k);
+		if (d.v->d_type != DT_SUBVOL)
+			inums[nr++] = le64_to_cpu(d.v->d_inum);
+	}
+	bch2_trans_iter_exit(trans, &iter);
+	if (ret)
+		return ret;
+
+	sort(inums, nr, sizeof(inums[0]), u64_cmp, NULL);
+
+	for (i = 0; i < nr; i++) {
+		k = bch2_bkey_get_iter(trans, &iter, BTREE_ID_inodes,
+				       SPOS(0, inums[i], snapshot),
+				       BTREE_ITER_CACHED);
+		ret = bkey_err(k);
+		bch2_trans_iter_exit(trans, &iter);
+
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			return ret;
+	}
+
+	return 0;
+}
+
 int bch2_readdir(struct bch_fs *c, subvol_inum inum, struct dir_context *ctx)
 {
 	struct btree_trans *trans = bch2_trans_get(c);
@@ -548,6 +608,7 @@ int bch2_readdir(struct bch_fs *c, subvol_inum inum, struct dir_context *ctx)
 	u32 snapshot;
 	struct bkey_buf sk;
 	struct qstr name;
+	u64 prefetch_end = 0;
 	int ret;
 
 	bch2_bkey_buf_init(&sk);
@@ -564,6 +625,13 @@ int bch2_readdir(struct bch_fs *c, subvol_inum inum, struct dir_context *ctx)
 		if (k.k->type != KEY_TYPE_dirent)
 			continue;
 
+		if (k.k->p.offset >= prefetch_end) {
+			ret = bch2_readdir_prefetch_inodes(trans, inum.inum, snapshot,
+							   k.k->p.offset, &prefetch_end);
+			if (ret)
+				break;
+		}
+
 		dirent = bkey_s_c_to_dirent(k);
 
 		ret = bch2_dirent_read_target(trans, inum, dirent, &target);
@@ -0,0 +1,255 @@
+// SPDX-License-Identifier: GPL-2.0
+
+/*
+ * Dirent lookup cache:
+ *
+ * Caches the results of dirent lookups - positive and negative - so that
+ * repeated lookups in very large directories don't have to hash the name and
+ * walk the dirents btree (and probe over hash collisions) every time.
+ *
+ * Entries are keyed by (subvolume, directory, name hash); the hash is a
+ * full_name_hash() of the name, not the dirent hash, so a lookup that hits
+ * doesn't need the directory's hash info and doesn't do any siphash.
+ *
+ * Consistency: the VFS paths that add or remove dirents (create, link, unlink,
+ * rename) hold the directory's inode lock exclusively and invalidate the
+ * affected names; lookups, which populate the cache, hold it shared. readdir
+ * doesn't add entries: a directory listing would fill the cache with names
+ * that mostly never get looked up. Dirent modifications that don't go through the VFS (fsck, subvolume
+ * deletion) bump c->dirent_cache.gen; entries record the generation that was
+ * current when the lookup started, and entries from an older generation are
+ * ignored.
+ */
+
+#include "bcachefs.h"
+#include "dirent_cache.h"
+
+#include <linux/dcache.h>
+#include <linux/shrinker.h>
+#include <linux/stringhash.h>
+
+static const struct rhashtable_params bch2_dirent_cache_params = {
+	.head_offset		= offsetof(struct dirent_cache_entry, hash),
+	.key_offset		= offsetof(struct dirent_cache_entry, key),
+	.key_len		= sizeof(struct dirent_cache_key),
+	.automatic_shrinking	= true,
+};
+
+static inline struct dirent_cache_key dirent_cache_key(subvol_inum dir,
+						       const struct qstr *name)
+{
+	return (struct dirent_cache_key) {
+		.subvol	= dir.subvol,
+		.hash	= full_name_hash(NULL, name->name, name->len),
+		.dir	= dir.inum,
+	};
+}
+
+static void dirent_cache_entry_free(struct dirent_cache *dc,
+				    struct dirent_cache_entry *e)
+{
+	if (!rhashtable_remove_fast(&dc->table, &e->hash,
+				    bch2_dirent_cache_params)) {
+		atomic_long_dec(&dc->nr);
+		kfree_rcu(e, rcu);
+	}
+}
+
+/*
+ * Returns 1 and the target on a positive hit, -ENOENT on a negative hit, or 0
+ * if the name isn't cached:
+ */
+int bch2_dirent_cache_lookup(struct bch_fs *c, subvol_inum dir,
+			     const struct qstr *name, subvol_inum *target)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+	struct dirent_cache_key key = dirent_cache_key(dir, name);
+	struct dirent_cache_entry *e;
+	int ret = 0;
+
+	rcu_read_lock();
+	e = rhashtable_lookup(&dc->table, &key, bch2_dirent_cache_params);
+	if (e &&
+	    e->gen == bch2_dirent_cache_gen(c) &&
+	    e->name_len == name->len &&
+	    !memcmp(e->name, name->name, name->len)) {
+		if (!e->accessed)
+			e->accessed = true;
+
+		*target = e->target;
+		ret = target->inum ? 1 : -BCH_ERR_ENOENT_str_hash_lookup;
+	}
+	rcu_read_unlock();
+
+	atomic_long_inc(ret ? &dc->hits : &dc->misses);
+	return ret;
+}
+
+/*
+ * Add the result of a btree lookup: @gen must have been read with
+ * bch2_dirent_cache_gen() before the btree lookup was done, and @target.inum
+ * is 0 if the name doesn't exist:
+ */
+void bch2_dirent_cache_add(struct bch_fs *c, subvol_inum dir, u64 gen,
+			   const struct qstr *name, subvol_inum target)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+	struct dirent_cache_entry *e, *old;
+
+	if (gen != bch2_dirent_cache_gen(c))
+		return;
+
+	e = kmalloc(sizeof(*e) + name->len, GFP_NOFS|__GFP_NOWARN);
+	if (!e)
+		return;
+
+	e->key		= dirent_cache_key(dir, name);
+	e->gen		= gen;
+	e->target	= target;
+	e->accessed	= false;
+	e->name_len	= name->len;
+	memcpy(e->name, name->name, name->len);
+
+	rcu_read_lock();
+	old = rhashtable_lookup_get_insert_fast(&dc->table, &e->hash,
+						bch2_dirent_cache_params);
+	if (!old)
+		atomic_long_inc(&dc->nr);
+	else if (!IS_ERR(old) &&
+		 !rhashtable_replace_fast(&dc->table, &old->hash, &e->hash,
+					  bch2_dirent_cache_params))
+		kfree_rcu(old, rcu);
+	else
+		kfree(e);
+	rcu_read_unlock();
+}
+
+void bch2_dirent_cache_invalidate(struct bch_fs *c, subvol_inum dir,
+				  const struct qstr *name)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+	struct dirent_cache_key key = dirent_cache_key(dir, name);
+	struct dirent_cache_entry *e;
+
+	rcu_read_lock();
+	e = rhashtable_lookup(&dc->table, &key, bch2_dirent_cache_params);
+	if (e)
+		dirent_cache_entry_free(dc, e);
+	rcu_read_unlock();
+}
+
+static unsigned long bch2_dirent_cache_scan(struct shrinker *shrink,
+					    struct shrink_control *sc)
+{
+	struct bch_fs *c = shrink->private_data;
+	struct dirent_cache *dc = &c->dirent_cache;
+	struct bucket_table *tbl;
+	struct dirent_cache_entry *e;
+	size_t scanned = 0, freed = 0, nr = sc->nr_to_scan;
+	u64 gen = bch2_dirent_cache_gen(c);
+	unsigned start;
+
+	mutex_lock(&dc->lock);
+	rcu_read_lock();
+
+	tbl = rht_dereference_rcu(dc->table.tbl, &dc->table);
+	if (dc->shrink_iter >= tbl->size)
+		dc->shrink_iter = 0;
+	start = dc->shrink_iter;
+
+	do {
+		struct rhash_head *pos, *next;
+
+		pos = rht_ptr_rcu(rht_bucket(tbl, dc->shrink_iter));
+
+		while (!rht_is_a_nulls(pos)) {
+			next = rht_dereference_bucket_rcu(pos->next, tbl, dc->shrink_iter);
+			e = container_of(pos, struct dirent_cache_entry, hash);
+
+			if (e->accessed && e->gen == gen) {
+				e->accessed = false;
+			} else {
+				dirent_cache_entry_free(dc, e);
+				freed++;
+			}
+
+			scanned++;
+			if (scanned >= nr)
+				break;
+			pos = next;
+		}
+
+		dc->shrink_iter++;
+		if (dc->shrink_iter >= tbl->size)
+			dc->shrink_iter = 0;
+	} while (scanned < nr && dc->shrink_iter != start);
+
+	rcu_read_unlock();
+	mutex_unlock(&dc->lock);
+
+	return freed;
+}
+
+static unsigned long bch2_dirent_cache_count(struct shrinker *shrink,
+					     struct shrink_control *sc)
+{
+	struct bch_fs *c = shrink->private_data;
+
+	return max(0L, atomic_long_read(&c->dirent_cache.nr));
+}
+
+void bch2_dirent_cache_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+
+	prt_printf(out, "nr:\t%lu",	atomic_long_read(&dc->nr));
+	prt_newline(out);
+	prt_printf(out, "gen:\t%llu",	bch2_dirent_cache_gen(c));
+	prt_newline(out);
+	prt_printf(out, "hits:\t%lu",	atomic_long_read(&dc->hits));
+	prt_newline(out);
+	prt_printf(out, "misses:\t%lu",	atomic_long_read(&dc->misses));
+	prt_newline(out);
+}
+
+static void dirent_cache_entry_destroy(void *p, void *arg)
+{
+	kfree(p);
+}
+
+void bch2_fs_dirent_cache_exit(struct bch_fs *c)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+
+	shrinker_free(dc->shrink);
+
+	if (dc->table_init_done)
+		rhashtable_free_and_destroy(&dc->table,
+					    dirent_cache_entry_destroy, NULL);
+}
+
+void bch2_fs_dirent_cache_init_early(struct bch_fs *c)
+{
+	mutex_init(&c->dirent_cache.lock);
+}
+
+int bch2_fs_dirent_cache_init(struct bch_fs *c)
+{
+	struct dirent_cache *dc = &c->dirent_cache;
+	struct shrinker *shrink;
+
+	if (rhashtable_init(&dc->table, &bch2_dirent_cache_params))
+		return -BCH_ERR_ENOMEM_fs_dirent_cache_init;
+
+	dc->table_init_done = true;
+
+	shrink = shrinker_alloc(0, "%s-dirent_cache", c->name);
+	if (!shrink)
+		return -BCH_ERR_ENOMEM_fs_dirent_cache_init;
+	dc->shrink = shrink;
+	shrink->count_objects	= bch2_dirent_cache_count;
+	shrink->scan_objects	= bch2_dirent_cache_scan;
+	shrink->private_data	= c;
+	shrinker_register(shrink);
+	return 0;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_DIRENT_CACHE_H
+#define _BCACHEFS_DIRENT_CACHE_H
+
+static inline u64 bch2_dirent_cache_gen(struct bch_fs *c)
+{
+	return atomic64_read(&c->dirent_cache.gen);
+}
+
+static inline void bch2_dirent_cache_invalidate_all(struct bch_fs *c)
+{
+	atomic64_inc(&c->dirent_cache.gen);
+}
+
+int bch2_dirent_cache_lookup(struct bch_fs *, subvol_inum,
+			     const struct qstr *, subvol_inum *);
+void bch2_dirent_cache_add(struct bch_fs *, subvol_inum, u64,
+			   const struct qstr *, subvol_inum);
+void bch2_dirent_cache_invalidate(struct bch_fs *, subvol_inum,
+				  const struct qstr *);
+
+void bch2_dirent_cache_to_text(struct printbuf *, struct bch_fs *);
+
+void bch2_fs_dirent_cache_exit(struct bch_fs *);
+void bch2_fs_dirent_cache_init_early(struct bch_fs *);
+int bch2_fs_dirent_cache_init(struct bch_fs *);
+
+#endif /* _BCACHEFS_DIRENT_CACHE_H */
@@ -0,0 +1,46 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_DIRENT_CACHE_TYPES_H
+#define _BCACHEFS_DIRENT_CACHE_TYPES_H
+
+#include "subvolume_types.h"
+
+struct dirent_cache_key {
+	u32			subvol;
+	u32			hash;
+	u64			dir;
+} __packed __aligned(4);
+
+/*
+ * Cached result of a dirent lookup: @target.inum == 0 is a negative entry
+ */
+struct dirent_cache_entry {
+	struct rhash_head	hash;
+	struct rcu_head		rcu;
+	struct dirent_cache_key	key;
+	u64			gen;
+	subvol_inum		target;
+	bool			accessed;
+	u16			name_len;
+	char			name[];
+};
+
+struct dirent_cache {
+	struct mutex		lock;
+	struct rhashtable	table;
+	bool			table_init_done;
+
+	/*
+	 * Bumped when dirents are modified outside of the normal VFS paths
+	 * (e.g. fsck), invalidating every entry that was looked up before:
+	 */
+	atomic64_t		gen;
+	atomic_long_t		nr;
+
+	struct shrinker		*shrink;
+	unsigned		shrink_iter;
+
+	atomic_long_t		hits;
+	atomic_long_t		misses;
+};
+
+#endif /* _BCACHEFS_DIRENT_CACHE_TYPES_H */
@@ -20,10 +20,13 @@
 	x(ENOMEM,			ENOMEM_trans_kmalloc)			\
 	x(ENOMEM,			ENOMEM_trans_log_msg)			\
 	x(ENOMEM,			ENOMEM_do_encrypt)			\
+	x(ENOMEM,			ENOMEM_crypt_wq)			\
 	x(ENOMEM,			ENOMEM_ec_read_extent)			\
 	x(ENOMEM,			ENOMEM_ec_stripe_mem_alloc)		\
 	x(ENOMEM,			ENOMEM_ec_new_stripe_alloc)		\
 	x(ENOMEM,			ENOMEM_fs_btree_cache_init)		\
+	x(ENOMEM,			ENOMEM_fs_dirent_cache_init)		\
+	x(ENOMEM,			ENOMEM_fs_quota_init)			\
 	x(ENOMEM,			ENOMEM_fs_btree_key_cache_init)		\
 	x(ENOMEM,			ENOMEM_fs_counters_init)		\
 	x(ENOMEM,			ENOMEM_fs_btree_write_buffer_init)	\
@@ -47,6 +50,7 @@
 	x(ENOMEM,			ENOMEM_dio_write_bioset_init)		\
 	x(ENOMEM,			ENOMEM_nocow_flush_bioset_init)		\
 	x(ENOMEM,			ENOMEM_promote_table_init)		\
+	x(ENOMEM,			ENOMEM_promote_filter_init)		\
 	x(ENOMEM,			ENOMEM_compression_bounce_read_init)	\
 	x(ENOMEM,			ENOMEM_compression_bounce_write_init)	\
 	x(ENOMEM,			ENOMEM_compression_workspace_init)	\
@@ -71,6 +75,7 @@
 	x(ENOMEM,			ENOMEM_gc_repair_key)			\
 	x(ENOMEM,			ENOMEM_fsck_extent_ends_at)		\
 	x(ENOMEM,			ENOMEM_fsck_add_nlink)			\
+	x(ENOMEM,			ENOMEM_fsck_dirent_hash)		\
 	x(ENOMEM,			ENOMEM_journal_key_insert)		\
 	x(ENOMEM,			ENOMEM_journal_keys_sort)		\
 	x(ENOMEM,			ENOMEM_read_superblock_clean)		\
@@ -109,6 +114,7 @@
 	x(ENOENT,			ENOENT_dirent_doesnt_match_inode)	\
 	x(ENOENT,			ENOENT_dev_not_found)			\
 	x(ENOENT,			ENOENT_dev_idx_not_found)		\
+	x(ENOENT,			ENOENT_time_stats_hist)			\
 	x(ENOTEMPTY,			ENOTEMPTY_dir_not_empty)		\
 	x(ENOTEMPTY,			ENOTEMPTY_subvol_not_empty)		\
 	x(0,				open_buckets_empty)			\
@@ -234,6 +240,7 @@
 	x(EIO,				btree_node_read_error)			\
 	x(EIO,				btree_node_read_validate_error)		\
 	x(EIO,				btree_need_topology_repair)		\
+	x(EIO,				scrub_dev_offline)			\
 	x(BCH_ERR_btree_node_read_err,	btree_node_read_err_fixable)		\
 	x(BCH_ERR_btree_node_read_err,	btree_node_read_err_want_retry)		\
 	x(BCH_ERR_btree_node_read_err,	btree_node_read_err_must_retry)		\
@@ -245,6 +252,7 @@
 	x(BCH_ERR_nopromote,		nopromote_unwritten)			\
 	x(BCH_ERR_nopromote,		nopromote_congested)			\
 	x(BCH_ERR_nopromote,		nopromote_in_flight)			\
+	x(BCH_ERR_nopromote,		nopromote_cold)				\
 	x(BCH_ERR_nopromote,		nopromote_no_writes)			\
 	x(BCH_ERR_nopromote,		nopromote_enomem)
 
@@ -10,6 +10,7 @@
 #include "fs-io-pagecache.h"
 #include "io_read.h"
 #include "io_write.h"
+#include "rebalance.h"
 
 #include <linux/backing-dev.h>
 #include <linux/pagemap.h>
@@ -1051,6 +1052,9 @@ ssize_t bch2_write_iter(struct kiocb *iocb, struct iov_iter *from)
 	struct bch_inode_info *inode = file_bch_inode(file);
 	ssize_t ret;
 
+	if (!(iocb->ki_flags & IOCB_NOWAIT))
+		bch2_rebalance_writeback_throttle(inode->v.i_sb->s_fs_info);
+
 	if (iocb->ki_flags & IOCB_DIRECT) {
 		ret = bch2_direct_write(iocb, from);
 		goto out;
@@ -476,6 +476,165 @@ static long bch2_ioctl_subvolume_destroy(struct bch_fs *c, struct file *filp,
 	return ret;
 }
 
+static int bch2_create_batch_entry_get(struct bch_fs *c, struct file *filp,
+				       struct bch_ioctl_create_batch_entry *u,
+				       struct bch_create_batch_entry *e)
+{
+	struct dentry *parent = filp->f_path.dentry;
+	struct dentry *dentry;
+	umode_t mode = u->mode;
+	char *name;
+	int ret;
+
+	if (mode & S_IFMT) {
+		if (!S_ISREG(mode))
+			return -EINVAL;
+	} else {
+		mode |= S_IFREG;
+	}
+
+	if (!u->name_len)
+		return -EINVAL;
+	if (u->name_len > BCH_NAME_MAX)
+		return -ENAMETOOLONG;
+
+	if (u->data_len &&
+	    (!c->opts.inline_data ||
+	     u->data_len > min(block_bytes(c) / 2, 1024U)))
+		return -EINVAL;
+
+	name = memdup_user_nul(u64_to_user_ptr(u->name_ptr), u->name_len);
+	if (IS_ERR(name))
+		return PTR_ERR(name);
+
+	dentry = lookup_one(file_mnt_idmap(filp), name, parent, u->name_len);
+	kfree(name);
+	if (IS_ERR(dentry))
+		return PTR_ERR(dentry);
+
+	if (d_really_is_positive(dentry)) {
+		ret = -EEXIST;
+		goto err;
+	}
+
+	if (!IS_POSIXACL(d_inode(parent)))
+		mode &= ~current_umask();
+
+	ret = security_inode_create(d_inode(parent), dentry, mode);
+	if (ret)
+		goto err;
+
+	e->data = NULL;
+	if (u->data_len) {
+		e->data = memdup_user(u64_to_user_ptr(u->data_ptr), u->data_len);
+		ret = PTR_ERR_OR_ZERO(e->data);
+		if (ret)
+			goto err;
+	}
+
+	e->dentry	= dentry;
+	e->mode		= mode;
+	e->data_len	= u->data_len;
+	return 0;
+err:
+	dput(dentry);
+	return ret;
+}
+
+static void bch2_create_batch_entry_put(struct bch_create_batch_entry *e)
+{
+	dput(e->dentry);
+	kfree(e->data);
+}
+
+static long bch2_ioc_create_batch(struct bch_fs *c, struct file *filp,
+				  struct bch_inode_info *dir,
+				  struct bch_ioctl_create_batch __user *user_arg)
+{
+	struct bch_ioctl_create_batch arg;
+	struct bch_ioctl_create_batch_entry *u = NULL;
+	struct bch_create_batch_entry *e = NULL;
+	unsigned i, nr;
+	long ret;
+
+	if (copy_from_user(&arg, user_arg, sizeof(arg)))
+		return -EFAULT;
+
+	if (arg.flags || arg.pad || arg.nr > BCH_CREATE_BATCH_MAX)
+		return -EINVAL;
+
+	if (!S_ISDIR(dir->v.i_mode))
+		return -ENOTDIR;
+
+	ret = mnt_want_write_file(filp);
+	if (ret)
+		return ret;
+
+	u = kvmalloc_array(arg.nr, sizeof(*u), GFP_KERNEL);
+	e = kcalloc(BCH_CREATE_BATCH_TRANS_MAX, sizeof(*e), GFP_KERNEL);
+	if (!u || !e) {
+		ret = -ENOMEM;
+		goto err;
+	}
+
+	if (copy_from_user(u, u64_to_user_ptr(arg.entries),
+			   array_size(arg.nr, sizeof(*u)))) {
+		ret = -EFAULT;
+		goto err;
+	}
+
+	arg.nr_created = 0;
+
+	inode_lock_nested(&dir->v, I_MUTEX_PARENT);
+
+	ret = IS_DEADDIR(&dir->v)
+		? -BCH_ERR_ENOENT_directory_dead
+		: inode_permission(file_mnt_idmap(filp), &dir->v, MAY_WRITE|MAY_EXEC);
+
+	while (!ret && arg.nr_created < arg.nr) {
+		/*
+		 * If we fail to look up an entry, create the entries before
+		 * it so that @nr_created is exact:
+		 */
+		for (nr = 0;
+		     nr < min_t(unsigned, arg.nr - arg.nr_created,
+				BCH_CREATE_BATCH_TRANS_MAX);
+		     nr++) {
+			ret = bch2_create_batch_entry_get(c, filp,
+						u + arg.nr_created + nr, e + nr);
+			if (ret)
+				break;
+		}
+
+		if (nr) {
+			int ret2 = bch2_create_batch(dir, e, nr);
+
+			if (!ret2) {
+				for (i = 0; i < nr; i++) {
+					d_instantiate(e[i].dentry, &e[i].inode->v);
+					fsnotify_create(&dir->v, e[i].dentry);
+				}
+				arg.nr_created += nr;
+			}
+
+			for (i = 0; i < nr; i++)
+				bch2_create_batch_entry_put(&e[i]);
+
+			ret = ret2 ?: ret;
+		}
+	}
+
+	inode_unlock(&dir->v);
+
+	if (put_user(arg.nr_created, &user_arg->nr_created))
+		ret = ret ?: -EFAULT;
+err:
+	kfree(e);
+	kvfree(u);
+	mnt_drop_write_file(filp);
+	return ret;
+}
+
 long bch2_fs_file_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 {
 	struct bch_inode_info *inode = file_bch_inode(file);
@@ -505,6 +664,11 @@ long bch2_fs_file_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 					       (void __user *) arg);
 		break;
 
+	case BCHFS_IOC_CREATE_BATCH:
+		ret = bch2_ioc_create_batch(c, file, inode,
+					    (void __user *) arg);
+		break;
+
 	case FS_IOC_GETVERSION:
 		ret = -ENOTTY;
 		break;
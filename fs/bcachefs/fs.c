@@ -8,6 +8,7 @@
 #include "buckets.h"
 #include "chardev.h"
 #include "dirent.h"
+#include "dirent_cache.h"
 #include "errcode.h"
 #include "extents.h"
 #include "fs.h"
@@ -250,6 +251,12 @@ struct inode *bch2_vfs_inode_get(struct bch_fs *c, subvol_inum inum)
 	int ret = lockrestart_do(trans,
 		bch2_subvolume_get(trans, inum.subvol, true, 0, &subvol) ?:
 		bch2_inode_find_by_inum_trans(trans, inum, &inode_u)) ?:
+		/*
+		 * may still be here if it's being deleted in the background;
+		 * other unlinked inodes can be opened by handle as before:
+		 */
+		((inode_u.bi_flags & BCH_INODE_unlinked) &&
+		 bch2_inode_rm_pending(c, inum) ? -BCH_ERR_ENOENT_inode : 0) ?:
 		PTR_ERR_OR_ZERO(inode = bch2_new_inode(trans));
 	if (!ret) {
 		bch2_vfs_inode_init(trans, inum, inode, &inode_u, &subvol);
@@ -331,6 +338,7 @@ __bch2_create(struct mnt_idmap *idmap,
 	}
 
 	if (!(flags & BCH_CREATE_TMPFILE)) {
+		bch2_dirent_cache_invalidate(c, inode_inum(dir), &dentry->d_name);
 		bch2_inode_update_after_write(trans, dir, &dir_u,
 					      ATTR_MTIME|ATTR_CTIME);
 		mutex_unlock(&dir->ei_update_lock);
@@ -363,6 +371,173 @@ __bch2_create(struct mnt_idmap *idmap,
 	goto err;
 }
 
+static int bch2_create_inline_data(struct btree_trans *trans, subvol_inum inum,
+				   struct bch_create_batch_entry *e)
+{
+	struct bch_fs *c = trans->c;
+	unsigned val_bytes = round_up(e->data_len, 8);
+	u32 snapshot;
+	int ret = bch2_subvolume_get_snapshot(trans, inum.subvol, &snapshot);
+	if (ret)
+		return ret;
+
+	struct bkey_i_inline_data *id =
+		bch2_trans_kmalloc(trans, sizeof(*id) + val_bytes);
+	ret = PTR_ERR_OR_ZERO(id);
+	if (ret)
+		return ret;
+
+	bkey_inline_data_init(&id->k_i);
+	id->k.p		= SPOS(inum.inum, e->inode_u.bi_sectors, snapshot);
+	id->k.size	= e->inode_u.bi_sectors;
+
+	memcpy(id->v.data, e->data, e->data_len);
+	memset(id->v.data + e->data_len, 0, val_bytes - e->data_len);
+	set_bkey_val_bytes(&id->k, val_bytes);
+
+	bch2_check_set_feature(c, BCH_FEATURE_inline_data);
+
+	return bch2_btree_insert_trans(trans, BTREE_ID_extents, &id->k_i, 0);
+}
+
+/*
+ * Create up to BCH_CREATE_BATCH_TRANS_MAX regular files in @dir, along with
+ * their (optional) inline data, in a single transaction: the caller is
+ * responsible for looking up the (negative) dentries and instantiating them
+ * on success.
+ */
+int bch2_create_batch(struct bch_inode_info *dir,
+		      struct bch_create_batch_entry *e, unsigned nr)
+{
+	struct bch_fs *c = dir->v.i_sb->s_fs_info;
+	struct btree_trans *trans;
+	struct bch_inode_unpacked dir_u;
+	struct bch_subvolume subvol;
+	struct bch_qid qid = dir->ei_qid;
+	u64 journal_seq = 0, sectors = 0;
+	unsigned i;
+	int ret = 0;
+
+	BUG_ON(nr > BCH_CREATE_BATCH_TRANS_MAX);
+
+	for (i = 0; i < nr; i++) {
+		e[i].inode = NULL;
+		e[i].default_acl = e[i].acl = NULL;
+	}
+
+	/*
+	 * preallocate acls + vfs inodes before btree transaction, so that
+	 * nothing can fail after the transaction succeeds:
+	 */
+	for (i = 0; i < nr; i++) {
+		EBUG_ON(!S_ISREG(e[i].mode));
+#ifdef CONFIG_BCACHEFS_POSIX_ACL
+		ret = posix_acl_create(&dir->v, &e[i].mode,
+				       &e[i].default_acl, &e[i].acl);
+		if (ret)
+			goto err;
+#endif
+		e[i].inode = to_bch_ei(new_inode(c->vfs_sb));
+		if (unlikely(!e[i].inode)) {
+			ret = -ENOMEM;
+			goto err;
+		}
+
+		bch2_inode_init_early(c, &e[i].inode_u);
+
+		if (e[i].data_len) {
+			e[i].inode_u.bi_size	= e[i].data_len;
+			e[i].inode_u.bi_sectors	=
+				round_up(e[i].data_len, block_bytes(c)) >> 9;
+			sectors += e[i].inode_u.bi_sectors;
+		}
+	}
+
+	mutex_lock(&dir->ei_update_lock);
+
+	trans = bch2_trans_get(c);
+retry:
+	bch2_trans_begin(trans);
+
+	ret = bch2_subvol_is_ro_trans(trans, dir->ei_subvol);
+
+	for (i = 0; i < nr && !ret; i++) {
+		ret = bch2_create_trans(trans,
+				inode_inum(dir), &dir_u, &e[i].inode_u,
+				&e[i].dentry->d_name,
+				from_kuid(i_user_ns(&dir->v), current_fsuid()),
+				from_kgid(i_user_ns(&dir->v), current_fsgid()),
+				e[i].mode, 0,
+				e[i].default_acl, e[i].acl,
+				(subvol_inum) { 0 }, 0);
+		if (!ret && e[i].data_len)
+			ret = bch2_create_inline_data(trans,
+				(subvol_inum) { dir->ei_subvol, e[i].inode_u.bi_inum },
+				&e[i]);
+	}
+
+	if (!ret) {
+		qid = bch_qid(&e[0].inode_u);
+		ret = bch2_quota_acct(c, qid, Q_INO, nr, KEY_TYPE_QUOTA_PREALLOC);
+	}
+	if (unlikely(ret))
+		goto err_before_quota;
+
+	ret   = bch2_subvolume_get(trans, dir->ei_subvol, true,
+				   BTREE_ITER_WITH_UPDATES, &subvol) ?:
+		bch2_trans_commit(trans, NULL, &journal_seq, 0);
+	if (unlikely(ret)) {
+		bch2_quota_acct(c, qid, Q_INO, -(s64) nr, KEY_TYPE_QUOTA_WARN);
+err_before_quota:
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			goto retry;
+		goto err_trans;
+	}
+
+	if (sectors)
+		bch2_quota_acct(c, qid, Q_SPC, sectors, KEY_TYPE_QUOTA_WARN);
+
+	for (i = 0; i < nr; i++)
+		bch2_dirent_cache_invalidate(c, inode_inum(dir), &e[i].dentry->d_name);
+
+	bch2_inode_update_after_write(trans, dir, &dir_u,
+				      ATTR_MTIME|ATTR_CTIME);
+	mutex_unlock(&dir->ei_update_lock);
+
+	for (i = 0; i < nr; i++) {
+		subvol_inum inum = {
+			.subvol	= dir->ei_subvol,
+			.inum	= e[i].inode_u.bi_inum,
+		};
+
+		bch2_vfs_inode_init(trans, inum, e[i].inode, &e[i].inode_u, &subvol);
+
+		set_cached_acl(&e[i].inode->v, ACL_TYPE_ACCESS, e[i].acl);
+		set_cached_acl(&e[i].inode->v, ACL_TYPE_DEFAULT, e[i].default_acl);
+
+		e[i].inode = bch2_inode_insert(c, e[i].inode);
+	}
+
+	bch2_trans_put(trans);
+out:
+	for (i = 0; i < nr; i++) {
+		posix_acl_release(e[i].default_acl);
+		posix_acl_release(e[i].acl);
+	}
+	return ret;
+err_trans:
+	mutex_unlock(&dir->ei_update_lock);
+	bch2_trans_put(trans);
+err:
+	for (i = 0; i < nr; i++)
+		if (e[i].inode) {
+			make_bad_inode(&e[i].inode->v);
+			iput(&e[i].inode->v);
+			e[i].inode = NULL;
+		}
+	goto out;
+}
+
 /* methods */
 
 static struct bch_inode_info *bch2_lookup_trans(struct btree_trans *trans,
@@ -371,14 +546,24 @@ static struct bch_inode_info *bch2_lookup_trans(struct btree_trans *trans,
 {
 	struct bch_fs *c = trans->c;
 	struct btree_iter dirent_iter = {};
+	struct bkey_s_c k = bkey_s_c_null;
 	subvol_inum inum = {};
+	u64 cache_gen = bch2_dirent_cache_gen(c);
 
-	int ret = bch2_hash_lookup(trans, &dirent_iter, bch2_dirent_hash_desc,
-				   dir_hash_info, dir, name, 0);
+	int ret = bch2_dirent_cache_lookup(c, dir, name, &inum);
+	if (ret < 0)
+		return ERR_PTR(ret);
+	if (ret > 0)
+		goto found;
+lookup:
+	ret = bch2_hash_lookup(trans, &dirent_iter, bch2_dirent_hash_desc,
+			       dir_hash_info, dir, name, 0);
+	if (bch2_err_matches(ret, ENOENT))
+		bch2_dirent_cache_add(c, dir, cache_gen, name, (subvol_inum) {});
 	if (ret)
 		return ERR_PTR(ret);
 
-	struct bkey_s_c k = bch2_btree_iter_peek_slot(&dirent_iter);
+	k = bch2_btree_iter_peek_slot(&dirent_iter);
 	ret = bkey_err(k);
 	if (ret)
 		goto err;
@@ -389,6 +574,8 @@ static struct bch_inode_info *bch2_lookup_trans(struct btree_trans *trans,
 	if (ret)
 		goto err;
 
+	bch2_dirent_cache_add(c, dir, cache_gen, name, inum);
+found:;
 	struct bch_inode_info *inode =
 		to_bch_ei(ilookup5_nowait(c->vfs_sb,
 					  bch2_inode_hash(inum),
@@ -402,6 +589,11 @@ static struct bch_inode_info *bch2_lookup_trans(struct btree_trans *trans,
 	ret =   bch2_subvolume_get(trans, inum.subvol, true, 0, &subvol) ?:
 		bch2_inode_find_by_inum_nowarn_trans(trans, inum, &inode_u) ?:
 		PTR_ERR_OR_ZERO(inode = bch2_new_inode(trans));
+	if (bch2_err_matches(ret, ENOENT) && !k.k) {
+		/* stale dirent cache entry: redo the lookup from the btree */
+		bch2_dirent_cache_invalidate(c, dir, name);
+		goto lookup;
+	}
 	if (bch2_err_matches(ret, ENOENT)) {
 		struct printbuf buf = PRINTBUF;
 
@@ -478,6 +670,8 @@ static int __bch2_link(struct bch_fs *c,
 					inode_inum(inode), &inode_u,
 					&dentry->d_name));
 
+	bch2_dirent_cache_invalidate(c, inode_inum(dir), &dentry->d_name);
+
 	if (likely(!ret)) {
 		bch2_inode_update_after_write(trans, dir, &dir_u,
 					      ATTR_MTIME|ATTR_CTIME);
@@ -528,6 +722,7 @@ int __bch2_unlink(struct inode *vdir, struct dentry *dentry,
 				  inode_inum(dir), &dir_u,
 				  &inode_u, &dentry->d_name,
 				  deleting_snapshot));
+	bch2_dirent_cache_invalidate(c, inode_inum(dir), &dentry->d_name);
 	if (unlikely(ret))
 		goto err;
 
@@ -671,6 +866,8 @@ static int bch2_rename2(struct mnt_idmap *idmap,
 					  &src_dentry->d_name,
 					  &dst_dentry->d_name,
 					  mode));
+	bch2_dirent_cache_invalidate(c, inode_inum(src_dir), &src_dentry->d_name);
+	bch2_dirent_cache_invalidate(c, inode_inum(dst_dir), &dst_dentry->d_name);
 	if (unlikely(ret))
 		goto err;
 
@@ -1558,7 +1755,9 @@ static void bch2_evict_inode(struct inode *vinode)
 				KEY_TYPE_QUOTA_WARN);
 		bch2_quota_acct(c, inode->ei_qid, Q_INO, -1,
 				KEY_TYPE_QUOTA_WARN);
-		bch2_inode_rm(c, inode_inum(inode));
+		if (inode->v.i_blocks < BCH_INODE_RM_ASYNC_SECTORS ||
+		    !bch2_inode_rm_async(c, inode_inum(inode)))
+			bch2_inode_rm(c, inode_inum(inode));
 	}
 
 	mutex_lock(&c->vfs_inodes_lock);
@@ -147,6 +147,26 @@ struct bch_inode_info *
 __bch2_create(struct mnt_idmap *, struct bch_inode_info *,
 	      struct dentry *, umode_t, dev_t, subvol_inum, unsigned);
 
+/* Max number of files bch2_create_batch() creates in one transaction: */
+#define BCH_CREATE_BATCH_TRANS_MAX	32
+
+struct bch_create_batch_entry {
+	struct dentry		*dentry;
+	umode_t			mode;
+	unsigned		data_len;
+	void			*data;
+
+	/* set by bch2_create_batch() on success: */
+	struct bch_inode_info	*inode;
+
+	struct bch_inode_unpacked inode_u;
+	struct posix_acl	*default_acl;
+	struct posix_acl	*acl;
+};
+
+int bch2_create_batch(struct bch_inode_info *,
+		      struct bch_create_batch_entry *, unsigned);
+
 int bch2_fs_quota_transfer(struct bch_fs *,
 			   struct bch_inode_info *,
 			   struct bch_qid,
@@ -722,23 +722,18 @@ static int hash_redo_key(struct btree_trans *trans,
 		bch2_trans_commit(trans, NULL, NULL, BCH_TRANS_COMMIT_no_enospc);
 }
 
-static int hash_check_key(struct btree_trans *trans,
-			  const struct bch_hash_desc desc,
-			  struct bch_hash_info *hash_info,
-			  struct btree_iter *k_iter, struct bkey_s_c hash_k)
+static int __hash_check_key(struct btree_trans *trans,
+			    const struct bch_hash_desc desc,
+			    struct bch_hash_info *hash_info,
+			    struct btree_iter *k_iter, struct bkey_s_c hash_k,
+			    u64 hash)
 {
 	struct bch_fs *c = trans->c;
 	struct btree_iter iter = { NULL };
 	struct printbuf buf = PRINTBUF;
 	struct bkey_s_c k;
-	u64 hash;
 	int ret = 0;
 
-	if (hash_k.k->type != desc.key_type)
-		return 0;
-
-	hash = desc.hash_bkey(hash_info, hash_k);
-
 	if (likely(hash == hash_k.k->p.offset))
 		return 0;
 
@@ -787,6 +782,120 @@ static int hash_check_key(struct btree_trans *trans,
 	goto out;
 }
 
+static int hash_check_key(struct btree_trans *trans,
+			  const struct bch_hash_desc desc,
+			  struct bch_hash_info *hash_info,
+			  struct btree_iter *k_iter, struct bkey_s_c hash_k)
+{
+	if (hash_k.k->type != desc.key_type)
+		return 0;
+
+	return __hash_check_key(trans, desc, hash_info, k_iter, hash_k,
+				desc.hash_bkey(hash_info, hash_k));
+}
+
+/*
+ * Dirents are checked one at a time, but hashing them one at a time leaves
+ * most of the siphash throughput on the table: when we miss, hash the next
+ * DIRENT_HASH_BATCH dirents in the same directory together.
+ */
+#define DIRENT_HASH_BATCH	32
+
+struct dirent_hash_batch {
+	unsigned		nr;
+	struct bpos		pos[DIRENT_HASH_BATCH];
+	struct qstr		names[DIRENT_HASH_BATCH];
+	u64			hashes[DIRENT_HASH_BATCH];
+	char			buf[DIRENT_HASH_BATCH][BCH_NAME_MAX];
+};
+
+static int dirent_hash_batch_fill(struct btree_trans *trans,
+				  struct dirent_hash_batch *b,
+				  struct bch_hash_info *hash_info,
+				  struct bpos start)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	int ret;
+
+	b->nr = 0;
+
+	for_each_btree_key_upto_norestart(trans, iter, BTREE_ID_dirents, start,
+				SPOS(start.inode, U64_MAX, U32_MAX),
+				BTREE_ITER_ALL_SNAPSHOTS, k, ret) {
+		if (k.k->type != KEY_TYPE_dirent)
+			continue;
+
+		struct qstr name = bch2_dirent_get_name(bkey_s_c_to_dirent(k));
+		unsigned len = min_t(unsigned, name.len, BCH_NAME_MAX);
+
+		memcpy(b->buf[b->nr], name.name, len);
+		b->pos[b->nr]	= k.k->p;
+		b->names[b->nr]	= (struct qstr) QSTR_INIT(b->buf[b->nr], len);
+
+		if (++b->nr == DIRENT_HASH_BATCH)
+			break;
+	}
+	bch2_trans_iter_exit(trans, &iter);
+
+	if (ret) {
+		b->nr = 0;
+		return ret;
+	}
+
+	bch2_str_hash_multi(hash_info, b->nr, b->names, b->hashes);
+	return 0;
+}
+
+static int dirent_hash_batch_get(struct btree_trans *trans,
+				 struct dirent_hash_batch *b,
+				 struct bch_hash_info *hash_info,
+				 struct bkey_s_c_dirent d, u64 *hash)
+{
+	struct qstr name = bch2_dirent_get_name(d);
+	unsigned i;
+	int ret;
+
+	for (i = 0; i < b->nr; i++)
+		if (bpos_eq(b->pos[i], d.k->p))
+			goto found;
+
+	ret = dirent_hash_batch_fill(trans, b, hash_info, d.k->p);
+	if (ret)
+		return ret;
+
+	i = 0;
+	if (!b->nr || !bpos_eq(b->pos[0], d.k->p))
+		goto slowpath;
+found:
+	/* The key may have been rewritten by a repair since we filled: */
+	if (!qstr_eq(b->names[i], name))
+		goto slowpath;
+
+	/* [0,2) reserved for dots */
+	*hash = max_t(u64, b->hashes[i], 2);
+	return 0;
+slowpath:
+	*hash = bch2_dirent_hash_desc.hash_bkey(hash_info, d.s_c);
+	return 0;
+}
+
+static int check_dirent_hash(struct btree_trans *trans,
+			     struct dirent_hash_batch *b,
+			     struct bch_hash_info *hash_info,
+			     struct btree_iter *iter, struct bkey_s_c k)
+{
+	u64 hash;
+
+	if (k.k->type != KEY_TYPE_dirent)
+		return 0;
+
+	return  dirent_hash_batch_get(trans, b, hash_info,
+				      bkey_s_c_to_dirent(k), &hash) ?:
+		__hash_check_key(trans, bch2_dirent_hash_desc, hash_info,
+				 iter, k, hash);
+}
+
 static struct bkey_s_c_dirent dirent_get_by_pos(struct btree_trans *trans,
 						struct btree_iter *iter,
 						struct bpos pos)
@@ -1847,7 +1956,8 @@ static int check_dirent(struct btree_trans *trans, struct btree_iter *iter,
 			struct bch_hash_info *hash_info,
 			struct inode_walker *dir,
 			struct inode_walker *target,
-			struct snapshots_seen *s)
+			struct snapshots_seen *s,
+			struct dirent_hash_batch *hashes)
 {
 	struct bch_fs *c = trans->c;
 	struct bkey_s_c_dirent d;
@@ -1911,7 +2021,7 @@ static int check_dirent(struct btree_trans *trans, struct btree_iter *iter,
 		goto out;
 	}
 
-	ret = hash_check_key(trans, bch2_dirent_hash_desc, hash_info, iter, k);
+	ret = check_dirent_hash(trans, hashes, hash_info, iter, k);
 	if (ret < 0)
 		goto err;
 	if (ret) {
@@ -1975,6 +2085,10 @@ int bch2_check_dirents(struct bch_fs *c)
 	struct inode_walker target = inode_walker_init();
 	struct snapshots_seen s;
 	struct bch_hash_info hash_info;
+	struct dirent_hash_batch *hashes = kvzalloc(sizeof(*hashes), GFP_KERNEL);
+
+	if (!hashes)
+		return -BCH_ERR_ENOMEM_fsck_dirent_hash;
 
 	snapshots_seen_init(&s);
 
@@ -1985,9 +2099,10 @@ int bch2_check_dirents(struct bch_fs *c)
 				k,
 				NULL, NULL,
 				BCH_TRANS_COMMIT_no_enospc,
-			check_dirent(trans, &iter, k, &hash_info, &dir, &target, &s)));
+			check_dirent(trans, &iter, k, &hash_info, &dir, &target, &s, hashes)));
 
 	snapshots_seen_exit(&s);
+	kvfree(hashes);
 	inode_walker_exit(&dir);
 	inode_walker_exit(&target);
 	bch_err_fn(c, ret);
@@ -600,6 +600,61 @@ static inline bool bkey_is_deleted_inode(struct bkey_s_c k)
 	return bkey_inode_flags(k) & BCH_INODE_unlinked;
 }
 
+static void inode_shard_range(struct bch_fs *c, u64 shard, u64 *min, u64 *max)
+{
+	unsigned bits = (c->opts.inodes_32bit ? 31 : 63);
+
+	if (c->opts.shard_inode_numbers) {
+		bits -= c->inode_shard_bits;
+
+		*min = (shard << bits);
+		*max = (shard << bits) | ~(ULLONG_MAX << bits);
+
+		*min = max_t(u64, *min, BLOCKDEV_INODE_MAX);
+	} else {
+		*min = BLOCKDEV_INODE_MAX;
+		*max = ~(ULLONG_MAX << bits);
+	}
+}
+
+static struct inode_alloc_shard *inode_alloc_shard(struct bch_fs *c, u64 inum)
+{
+	unsigned bits = (c->opts.inodes_32bit ? 31 : 63);
+	u64 shard = 0;
+
+	if (c->opts.shard_inode_numbers) {
+		shard = inum >> (bits - c->inode_shard_bits);
+		if (shard >= 1U << c->inode_shard_bits)
+			return NULL;
+	}
+
+	return c->inode_alloc + shard;
+}
+
+/*
+ * Called from the inode trigger when an inode is created by anyone - so that
+ * numbers allocated outside of bch2_inode_create() (fsck, other shards when
+ * shard_inode_numbers was toggled) don't get handed out again:
+ *
+ * Inode deletions don't clear bits: the inode number may still be in use in
+ * other snapshots, freed numbers get picked up the next time the window is
+ * seeded from the btree.
+ */
+static void inode_alloc_mark_used(struct bch_fs *c, u64 inum)
+{
+	struct inode_alloc_shard *s = inode_alloc_shard(c, inum);
+
+	if (!s || !READ_ONCE(s->start))
+		return;
+
+	spin_lock(&s->lock);
+	if (s->start &&
+	    inum >= s->start &&
+	    inum <  s->start + INODE_ALLOC_WINDOW)
+		__set_bit(inum - s->start, s->used);
+	spin_unlock(&s->lock);
+}
+
 int bch2_trigger_inode(struct btree_trans *trans,
 		       enum btree_id btree_id, unsigned level,
 		       struct bkey_s_c old,
@@ -631,6 +686,9 @@ int bch2_trigger_inode(struct btree_trans *trans,
 		BUG_ON(!trans->journal_res.seq);
 
 		bkey_s_to_inode_v3(new).v->bi_journal_seq = cpu_to_le64(trans->journal_res.seq);
+
+		if (nr > 0)
+			inode_alloc_mark_used(trans->c, new.k->p.offset);
 	}
 
 	if (flags & BTREE_TRIGGER_GC) {
@@ -727,6 +785,81 @@ static inline u32 bkey_generation(struct bkey_s_c k)
 	}
 }
 
+/*
+ * Returns the next free inode number in the shard's current window, or 0 if
+ * the window is exhausted (or was never seeded):
+ */
+static u64 inode_alloc_get(struct inode_alloc_shard *s, u64 min, u64 max)
+{
+	u64 inum = 0;
+	unsigned idx;
+
+	spin_lock(&s->lock);
+	if (!s->start ||
+	    s->start + INODE_ALLOC_WINDOW <= min ||
+	    s->start >= max ||
+	    s->next < s->start ||
+	    s->next >= s->start + INODE_ALLOC_WINDOW)
+		goto out;
+
+	idx = find_next_zero_bit(s->used, INODE_ALLOC_WINDOW, s->next - s->start);
+	if (idx < INODE_ALLOC_WINDOW) {
+		__set_bit(idx, s->used);
+		inum = s->start + idx;
+		s->next = inum + 1;
+	} else {
+		s->next = s->start + INODE_ALLOC_WINDOW;
+	}
+out:
+	spin_unlock(&s->lock);
+	return inum;
+}
+
+/*
+ * Build the in use bitmap for the window starting at @start by walking the
+ * inodes btree once, in all snapshots:
+ */
+static int inode_alloc_seed(struct btree_trans *trans, struct btree_iter *iter,
+			    struct inode_alloc_shard *s,
+			    u64 start, u64 min, u64 max)
+{
+	unsigned long used[BITS_TO_LONGS(INODE_ALLOC_WINDOW)];
+	u64 end = min_t(u64, start + INODE_ALLOC_WINDOW, max);
+	struct bkey_s_c k;
+	int ret = 0;
+
+	bitmap_zero(used, INODE_ALLOC_WINDOW);
+
+	if (start < min)
+		bitmap_set(used, 0, min - start);
+	if (end < start + INODE_ALLOC_WINDOW)
+		bitmap_set(used, end - start, start + INODE_ALLOC_WINDOW - end);
+
+	bch2_btree_iter_set_pos(iter, POS(0, max(start, min)));
+
+	while ((k = bch2_btree_iter_peek(iter)).k &&
+	       !(ret = bkey_err(k)) &&
+	       bkey_lt(k.k->p, POS(0, end))) {
+		__set_bit(k.k->p.offset - start, used);
+
+		/*
+		 * We don't need to iterate over keys in every snapshot once
+		 * we've found just one:
+		 */
+		bch2_btree_iter_set_pos(iter, POS(0, k.k->p.offset + 1));
+	}
+
+	if (ret)
+		return ret;
+
+	spin_lock(&s->lock);
+	s->start = start;
+	s->next	 = max(start, min);
+	bitmap_copy(s->used, used, INODE_ALLOC_WINDOW);
+	spin_unlock(&s->lock);
+	return 0;
+}
+
 /*
  * This just finds an empty slot:
  */
@@ -736,77 +869,76 @@ int bch2_inode_create(struct btree_trans *trans,
 		      u32 snapshot, u64 cpu)
 {
 	struct bch_fs *c = trans->c;
+	struct inode_alloc_shard *s;
 	struct bkey_s_c k;
-	u64 min, max, start, pos, *hint;
+	u64 min, max, window, pos, nr_windows, nr_seeded = 0;
 	int ret = 0;
-	unsigned bits = (c->opts.inodes_32bit ? 31 : 63);
 
-	if (c->opts.shard_inode_numbers) {
-		bits -= c->inode_shard_bits;
+	if (!c->opts.shard_inode_numbers)
+		cpu = 0;
 
-		min = (cpu << bits);
-		max = (cpu << bits) | ~(ULLONG_MAX << bits);
+	inode_shard_range(c, cpu, &min, &max);
+	s = c->inode_alloc + cpu;
 
-		min = max_t(u64, min, BLOCKDEV_INODE_MAX);
-		hint = c->unused_inode_hints + cpu;
-	} else {
-		min = BLOCKDEV_INODE_MAX;
-		max = ~(ULLONG_MAX << bits);
-		hint = c->unused_inode_hints;
-	}
+	window = READ_ONCE(s->start);
+	if (window + INODE_ALLOC_WINDOW <= min || window >= max)
+		window = min;
+	window = round_down(window, INODE_ALLOC_WINDOW);
 
-	start = READ_ONCE(*hint);
+	nr_windows = DIV_ROUND_UP(max - round_down(min, INODE_ALLOC_WINDOW),
+				  INODE_ALLOC_WINDOW);
 
-	if (start >= max || start < min)
-		start = min;
-
-	pos = start;
-	bch2_trans_iter_init(trans, iter, BTREE_ID_inodes, POS(0, pos),
+	bch2_trans_iter_init(trans, iter, BTREE_ID_inodes, POS(0, min),
 			     BTREE_ITER_ALL_SNAPSHOTS|
 			     BTREE_ITER_INTENT);
-again:
-	while ((k = bch2_btree_iter_peek(iter)).k &&
-	       !(ret = bkey_err(k)) &&
-	       bkey_lt(k.k->p, POS(0, max))) {
-		if (pos < iter->pos.offset)
-			goto found_slot;
 
-		/*
-		 * We don't need to iterate over keys in every snapshot once
-		 * we've found just one:
-		 */
-		pos = iter->pos.offset + 1;
-		bch2_btree_iter_set_pos(iter, POS(0, pos));
-	}
+	while (1) {
+		pos = inode_alloc_get(s, min, max);
+		if (pos) {
+			/*
+			 * The bitmap may be stale if the window was seeded
+			 * while an inode in it was being created - verify the
+			 * slot is free in every snapshot:
+			 */
+			bch2_btree_iter_set_pos(iter, POS(0, pos));
+			k = bch2_btree_iter_peek(iter);
+			ret = bkey_err(k);
+			if (ret)
+				goto err;
 
-	if (!ret && pos < max)
-		goto found_slot;
+			if (!k.k || k.k->p.offset != pos)
+				break;
+			continue;
+		}
 
-	if (!ret && start == min)
-		ret = -BCH_ERR_ENOSPC_inode_create;
+		/* Current window is exhausted, or was never seeded: */
+		if (nr_seeded || READ_ONCE(s->start) == window)
+			window += INODE_ALLOC_WINDOW;
+		if (window >= max)
+			window = round_down(min, INODE_ALLOC_WINDOW);
 
-	if (ret) {
-		bch2_trans_iter_exit(trans, iter);
-		return ret;
+		if (++nr_seeded > nr_windows) {
+			ret = -BCH_ERR_ENOSPC_inode_create;
+			goto err;
+		}
+
+		ret = inode_alloc_seed(trans, iter, s, window, min, max);
+		if (ret)
+			goto err;
 	}
 
-	/* Retry from start */
-	pos = start = min;
-	bch2_btree_iter_set_pos(iter, POS(0, pos));
-	goto again;
-found_slot:
 	bch2_btree_iter_set_pos(iter, SPOS(0, pos, snapshot));
 	k = bch2_btree_iter_peek_slot(iter);
 	ret = bkey_err(k);
-	if (ret) {
-		bch2_trans_iter_exit(trans, iter);
-		return ret;
-	}
+	if (ret)
+		goto err;
 
-	*hint			= k.k->p.offset;
 	inode_u->bi_inum	= k.k->p.offset;
 	inode_u->bi_generation	= bkey_generation(k);
 	return 0;
+err:
+	bch2_trans_iter_exit(trans, iter);
+	return ret;
 }
 
 static int bch2_inode_delete_keys(struct btree_trans *trans,
@@ -820,8 +952,9 @@ static int bch2_inode_delete_keys(struct btree_trans *trans,
 	int ret = 0;
 
 	/*
-	 * We're never going to be deleting partial extents, no need to use an
-	 * extent iterator:
+	 * For extents, each transaction deletes as much of the rest of the
+	 * file as will fit in one atomic update - a single range delete, not
+	 * one delete per extent:
 	 */
 	bch2_trans_iter_init(trans, &iter, id, POS(inum.inum, 0),
 			     BTREE_ITER_INTENT);
@@ -846,10 +979,15 @@ static int bch2_inode_delete_keys(struct btree_trans *trans,
 		bkey_init(&delete.k);
 		delete.k.p = iter.pos;
 
-		if (iter.flags & BTREE_ITER_IS_EXTENTS)
+		if (iter.flags & BTREE_ITER_IS_EXTENTS) {
 			bch2_key_resize(&delete.k,
-					bpos_min(end, k.k->p).offset -
-					iter.pos.offset);
+					KEY_SIZE_MAX & (~0 << trans->c->block_bits));
+			bch2_cut_back(end, &delete);
+
+			ret = bch2_extent_trim_atomic(trans, &iter, &delete);
+			if (ret)
+				goto err;
+		}
 
 		ret = bch2_trans_update(trans, &iter, &delete, 0) ?:
 		      bch2_trans_commit(trans, NULL, NULL,
@@ -1222,3 +1360,88 @@ int bch2_delete_dead_inodes(struct bch_fs *c)
 	bch2_trans_put(trans);
 	return ret;
 }
+
+static void bch2_inode_rm_work(struct work_struct *work)
+{
+	struct bch_fs *c = container_of(work, struct bch_fs, inode_rm_work);
+
+	while (1) {
+		subvol_inum inum = {};
+
+		mutex_lock(&c->inode_rm_lock);
+		if (c->inode_rm_pending.nr)
+			inum = darray_pop(&c->inode_rm_pending);
+		c->inode_rm_cur = inum;
+		mutex_unlock(&c->inode_rm_lock);
+
+		if (!inum.inum)
+			break;
+
+		int ret = bch2_inode_rm(c, inum);
+		bch_err_msg(c, ret, "deleting inode %llu:%u",
+			    inum.inum, inum.subvol);
+		bch2_write_ref_put(c, BCH_WRITE_REF_inode_rm);
+	}
+}
+
+/*
+ * Queue deletion of an unlinked inode's keys to a worker, instead of doing it
+ * synchronously from evict: the inode is already on the deleted_inodes list, so
+ * if we crash before the worker gets to it it'll be deleted at the next mount.
+ *
+ * That means we don't need a logged op (or a range tombstone key) to make the
+ * deletion restartable - deleted_inodes already records it, and
+ * bch2_inode_rm() picks up where the previous attempt left off.
+ *
+ * Returns false if the inode wasn't queued and the caller should delete it
+ * itself.
+ */
+bool bch2_inode_rm_async(struct bch_fs *c, subvol_inum inum)
+{
+	if (!bch2_write_ref_tryget(c, BCH_WRITE_REF_inode_rm))
+		return false;
+
+	mutex_lock(&c->inode_rm_lock);
+	int ret = darray_push(&c->inode_rm_pending, inum);
+	mutex_unlock(&c->inode_rm_lock);
+
+	if (ret) {
+		bch2_write_ref_put(c, BCH_WRITE_REF_inode_rm);
+		return false;
+	}
+
+	queue_work(c->write_ref_wq, &c->inode_rm_work);
+	return true;
+}
+
+/*
+ * Is this inode queued for (or undergoing) deletion by bch2_inode_rm_work()?
+ * Such an inode must not be instantiated again, since evicting it would
+ * delete it a second time.
+ */
+bool bch2_inode_rm_pending(struct bch_fs *c, subvol_inum inum)
+{
+	bool ret = false;
+
+	mutex_lock(&c->inode_rm_lock);
+	if (c->inode_rm_cur.subvol	== inum.subvol &&
+	    c->inode_rm_cur.inum	== inum.inum)
+		ret = true;
+
+	darray_for_each(c->inode_rm_pending, i)
+		if (i->subvol == inum.subvol && i->inum == inum.inum)
+			ret = true;
+	mutex_unlock(&c->inode_rm_lock);
+
+	return ret;
+}
+
+int bch2_fs_inode_init(struct bch_fs *c)
+{
+	for (unsigned i = 0; i < 1U << c->inode_shard_bits; i++)
+		spin_lock_init(&c->inode_alloc[i].lock);
+
+	mutex_init(&c->inode_rm_lock);
+	INIT_WORK(&c->inode_rm_work, bch2_inode_rm_work);
+	return 0;
+}
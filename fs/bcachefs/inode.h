@@ -127,6 +127,15 @@ int bch2_inode_create(struct btree_trans *, struct btree_iter *,
 
 int bch2_inode_rm(struct bch_fs *, subvol_inum);
 
+/*
+ * Unlinked inodes with at least this many sectors allocated are deleted in the
+ * background, so that the final iput() doesn't block on deleting every extent:
+ */
+#define BCH_INODE_RM_ASYNC_SECTORS	(1U << 16)
+
+bool bch2_inode_rm_async(struct bch_fs *, subvol_inum);
+bool bch2_inode_rm_pending(struct bch_fs *, subvol_inum);
+
 int bch2_inode_find_by_inum_nowarn_trans(struct btree_trans *,
 				  subvol_inum,
 				  struct bch_inode_unpacked *);
@@ -228,4 +237,6 @@ int bch2_inum_opts_get(struct btree_trans*, subvol_inum, struct bch_io_opts *);
 int bch2_inode_rm_snapshot(struct btree_trans *, u64, u32);
 int bch2_delete_dead_inodes(struct bch_fs *);
 
+int bch2_fs_inode_init(struct bch_fs *);
+
 #endif /* _BCACHEFS_INODE_H */
@@ -0,0 +1,22 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+#ifndef _BCACHEFS_INODE_TYPES_H
+#define _BCACHEFS_INODE_TYPES_H
+
+#define INODE_ALLOC_WINDOW_BITS		10
+#define INODE_ALLOC_WINDOW		(1U << INODE_ALLOC_WINDOW_BITS)
+
+/*
+ * In memory inode number allocator: each shard caches a bitmap of which inode
+ * numbers are in use over a window of INODE_ALLOC_WINDOW inode numbers, seeded
+ * from the inodes btree the first time the window is used, so that creates
+ * don't have to walk runs of in use inodes:
+ */
+struct inode_alloc_shard {
+	spinlock_t		lock;
+	/* First inode number covered by @used; 0 if the shard isn't seeded */
+	u64			start;
+	u64			next;
+	unsigned long		used[BITS_TO_LONGS(INODE_ALLOC_WINDOW)];
+} __aligned(SMP_CACHE_BYTES);
+
+#endif /* _BCACHEFS_INODE_TYPES_H */
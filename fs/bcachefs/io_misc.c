@@ -297,6 +297,13 @@ int bch2_truncate(struct bch_fs *c, subvol_inum inum, u64 new_i_size, u64 *i_sec
 
 /* finsert/fcollapse: */
 
+/*
+ * Bounded by the number of updates a transaction can hold: each extent shifted
+ * is a delete and an insert, plus the alloc updates from their triggers
+ */
+#define FINSERT_SHIFT_BATCH		32
+#define FINSERT_SHIFT_MAX_UPDATES	64
+
 void bch2_logged_op_finsert_to_text(struct printbuf *out, struct bch_fs *c, struct bkey_s_c k)
 {
 	struct bkey_s_c_logged_op_finsert op = bkey_s_c_to_logged_op_finsert(k);
@@ -392,9 +399,11 @@ case LOGGED_OP_FINSERT_shift_extents:
 	while (1) {
 		struct disk_reservation disk_res =
 			bch2_disk_reservation_init(c, 0);
-		struct bkey_i delete, *copy;
+		struct bkey_i *delete, *copy;
 		struct bkey_s_c k;
 		struct bpos src_pos = POS(inum.inum, src_offset);
+		unsigned nr = 0;
+		bool split, done = false;
 		u32 snapshot;
 
 		bch2_trans_begin(trans);
@@ -406,47 +415,77 @@ case LOGGED_OP_FINSERT_shift_extents:
 		bch2_btree_iter_set_snapshot(&iter, snapshot);
 		bch2_btree_iter_set_pos(&iter, SPOS(inum.inum, pos, snapshot));
 
-		k = insert
-			? bch2_btree_iter_peek_prev(&iter)
-			: bch2_btree_iter_peek_upto(&iter, POS(inum.inum, U64_MAX));
-		if ((ret = bkey_err(k)))
-			goto btree_err;
-
-		if (!k.k ||
-		    k.k->p.inode != inum.inum ||
-		    bkey_le(k.k->p, POS(inum.inum, src_offset)))
-			break;
-
-		copy = bch2_bkey_make_mut_noupdate(trans, k);
-		if ((ret = PTR_ERR_OR_ZERO(copy)))
-			goto btree_err;
-
-		if (insert &&
-		    bkey_lt(bkey_start_pos(k.k), src_pos)) {
-			bch2_cut_front(src_pos, copy);
-
-			/* Splitting compressed extent? */
-			bch2_disk_reservation_add(c, &disk_res,
-					copy->k.size *
-					bch2_bkey_nr_ptrs_allocated(bkey_i_to_s_c(copy)),
-					BCH_DISK_RESERVATION_NOFAIL);
+		/*
+		 * Shift a batch of extents per transaction, with a single
+		 * logged op update recording how far we got:
+		 */
+		while (nr < FINSERT_SHIFT_BATCH &&
+		       trans->nr_updates < FINSERT_SHIFT_MAX_UPDATES) {
+			k = insert
+				? bch2_btree_iter_peek_prev(&iter)
+				: bch2_btree_iter_peek_upto(&iter, POS(inum.inum, U64_MAX));
+			if ((ret = bkey_err(k)))
+				goto btree_err;
+
+			if (!k.k ||
+			    k.k->p.inode != inum.inum ||
+			    bkey_le(k.k->p, POS(inum.inum, src_offset))) {
+				done = true;
+				break;
+			}
+
+			copy = bch2_bkey_make_mut_noupdate(trans, k);
+			if ((ret = PTR_ERR_OR_ZERO(copy)))
+				goto btree_err;
+
+			split = insert && bkey_lt(bkey_start_pos(k.k), src_pos);
+			if (split) {
+				bch2_cut_front(src_pos, copy);
+
+				/* Splitting compressed extent? */
+				bch2_disk_reservation_add(c, &disk_res,
+						copy->k.size *
+						bch2_bkey_nr_ptrs_allocated(bkey_i_to_s_c(copy)),
+						BCH_DISK_RESERVATION_NOFAIL);
+			}
+
+			delete = bch2_trans_kmalloc(trans, sizeof(*delete));
+			if ((ret = PTR_ERR_OR_ZERO(delete)))
+				goto btree_err;
+
+			bkey_init(&delete->k);
+			delete->k.p = copy->k.p;
+			delete->k.p.snapshot = snapshot;
+			delete->k.size = copy->k.size;
+
+			copy->k.p.offset += shift;
+			copy->k.p.snapshot = snapshot;
+
+			op->v.pos = cpu_to_le64(insert ? bkey_start_offset(&delete->k) : delete->k.p.offset);
+
+			ret =   bch2_bkey_set_needs_rebalance(c, copy, &opts) ?:
+				bch2_btree_insert_trans(trans, BTREE_ID_extents, delete, 0) ?:
+				bch2_btree_insert_trans(trans, BTREE_ID_extents, copy, 0);
+			if (ret)
+				goto btree_err;
+
+			bch2_btree_iter_set_pos(&iter, SPOS(inum.inum, le64_to_cpu(op->v.pos), snapshot));
+			nr++;
+
+			/*
+			 * An extent straddling src_pos is the last one to shift;
+			 * the iterator doesn't see our uncommitted updates, so
+			 * peeking again would return it a second time:
+			 */
+			if (split) {
+				done = true;
+				break;
+			}
 		}
 
-		bkey_init(&delete.k);
-		delete.k.p = copy->k.p;
-		delete.k.p.snapshot = snapshot;
-		delete.k.size = copy->k.size;
-
-		copy->k.p.offset += shift;
-		copy->k.p.snapshot = snapshot;
-
-		op->v.pos = cpu_to_le64(insert ? bkey_start_offset(&delete.k) : delete.k.p.offset);
-
-		ret =   bch2_bkey_set_needs_rebalance(c, copy, &opts) ?:
-			bch2_btree_insert_trans(trans, BTREE_ID_extents, &delete, 0) ?:
-			bch2_btree_insert_trans(trans, BTREE_ID_extents, copy, 0) ?:
-			bch2_logged_op_update(trans, &op->k_i) ?:
-			bch2_trans_commit(trans, &disk_res, NULL, BCH_TRANS_COMMIT_no_enospc);
+		if (nr)
+			ret =   bch2_logged_op_update(trans, &op->k_i) ?:
+				bch2_trans_commit(trans, &disk_res, NULL, BCH_TRANS_COMMIT_no_enospc);
 btree_err:
 		bch2_disk_reservation_put(c, &disk_res);
 
@@ -456,6 +495,8 @@ case LOGGED_OP_FINSERT_shift_extents:
 			goto err;
 
 		pos = le64_to_cpu(op->v.pos);
+		if (done)
+			break;
 	}
 
 	op->v.state = LOGGED_OP_FINSERT_finish;
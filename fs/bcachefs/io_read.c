@@ -24,6 +24,7 @@
 #include "subvolume.h"
 #include "trace.h"
 
+#include <linux/hash.h>
 #include <linux/sched/mm.h>
 
 #ifndef CONFIG_BCACHEFS_NO_LATENCY_ACCT
@@ -89,8 +90,140 @@ static const struct rhashtable_params bch_promote_params = {
 	.key_len	= sizeof(struct bpos),
 };
 
+/*
+ * Read sketches: count-min sketches of recent reads, keyed by extent.
+ *
+ * The promote admission filter counts reads of data not yet on the promote
+ * target, so that we only promote data that has been read at least
+ * promote_min_reads times recently - a one pass scan of cold data shouldn't
+ * evict everything else from the promote target. A sequential read of a large
+ * extent arrives as several reads (one per readahead chunk), so for each extent
+ * we remember where the last read of it ended: a read that picks up there is
+ * part of the same pass, and isn't counted again.
+ *
+ * The cache heat sketch counts reads of cached pointers, so that cache buckets
+ * are only kept warm by extents that are being reread, and so that hot extents
+ * can be moved out of a bucket before it's invalidated.
+ *
+ * Counters saturate at READ_SKETCH_COUNT_MAX and are all halved every
+ * READ_SKETCH_WINDOW reads, so old reads age out. Updates are racy; these are
+ * only heuristics.
+ */
+#define READ_SKETCH_BITS		16
+#define READ_SKETCH_SIZE		(1U << READ_SKETCH_BITS)
+#define READ_SKETCH_COUNT_MAX		15
+#define READ_SKETCH_WINDOW		(READ_SKETCH_SIZE * 4)
+
+#define READ_STREAM_BITS		12
+#define READ_STREAM_SIZE		(1U << READ_STREAM_BITS)
+
+/* Sketches are keyed by extent: the btree it lives in and its start: */
+static u64 read_sketch_hash(struct bkey_s_c k)
+{
+	enum btree_id btree = k.k->type == KEY_TYPE_reflink_v
+		? BTREE_ID_reflink
+		: BTREE_ID_extents;
+	struct bpos pos = bkey_start_pos(k.k);
+
+	return hash_64((pos.inode * GOLDEN_RATIO_64 + pos.offset) *
+		       GOLDEN_RATIO_64 + btree, 64);
+}
+
+static void read_sketch_idx(struct bkey_s_c k, unsigned *idx)
+{
+	u64 h = read_sketch_hash(k);
+
+	idx[0] = h >> (64 - READ_SKETCH_BITS);
+	idx[1] = (h >> (64 - READ_SKETCH_BITS * 2)) & (READ_SKETCH_SIZE - 1);
+}
+
+static unsigned read_sketch_peek(u8 *sketch, struct bkey_s_c k)
+{
+	unsigned idx[2];
+
+	read_sketch_idx(k, idx);
+	return min(READ_ONCE(sketch[idx[0]]), READ_ONCE(sketch[idx[1]]));
+}
+
+/* Record a read of @k, returning the estimated read count: */
+static unsigned read_sketch_inc(u8 *sketch, atomic_t *reads, struct bkey_s_c k)
+{
+	unsigned idx[2];
+	unsigned nr = read_sketch_peek(sketch, k);
+
+	read_sketch_idx(k, idx);
+
+	/* Conservative update: only bump the counters at the minimum */
+	if (nr < READ_SKETCH_COUNT_MAX)
+		for (unsigned i = 0; i < ARRAY_SIZE(idx); i++)
+			if (READ_ONCE(sketch[idx[i]]) == nr)
+				WRITE_ONCE(sketch[idx[i]], nr + 1);
+
+	if (!(atomic_inc_return(reads) % READ_SKETCH_WINDOW))
+		for (unsigned i = 0; i < READ_SKETCH_SIZE; i++)
+			WRITE_ONCE(sketch[i], READ_ONCE(sketch[i]) >> 1);
+
+	return nr + 1;
+}
+
+/*
+ * Record a read of @sectors at @offset into @k, returning whether it continues
+ * the previous read of @k; each slot holds the hash of the extent last read
+ * through it in the high bits, and where that read ended in the low bits:
+ */
+static bool promote_stream_read(struct bch_fs *c, struct bkey_s_c k,
+				unsigned offset, unsigned sectors)
+{
+	u64 h = read_sketch_hash(k);
+	u64 *slot = c->promote_streams + (h & (READ_STREAM_SIZE - 1));
+	u64 tag = h & ~(u64) U32_MAX;
+	u64 old = xchg(slot, tag | (offset + sectors));
+
+	return offset && old == (tag | offset);
+}
+
+static unsigned promote_filter_read(struct bch_fs *c, struct bkey_s_c k,
+				    unsigned offset, unsigned sectors)
+{
+	return promote_stream_read(c, k, offset, sectors)
+		? read_sketch_peek(c->promote_filter, k)
+		: read_sketch_inc(c->promote_filter, &c->promote_filter_reads, k);
+}
+
+/* Has this cached extent been read at least cache_hot_reads times recently? */
+bool bch2_cached_extent_hot(struct bch_fs *c, struct bkey_s_c k)
+{
+	unsigned hot_reads = READ_ONCE(c->cache_hot_reads);
+
+	return hot_reads &&
+		read_sketch_peek(c->cache_heat, k) >= hot_reads;
+}
+
+static bool cached_extent_read(struct bch_fs *c, struct bkey_s_c k)
+{
+	return read_sketch_inc(c->cache_heat, &c->cache_heat_reads, k) >=
+		READ_ONCE(c->cache_hot_reads);
+}
+
+void bch2_promote_stats_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	u64 hit		= percpu_u64_get(&c->counters[BCH_COUNTER_read_promote_hit]);
+	u64 promoted	= percpu_u64_get(&c->counters[BCH_COUNTER_read_promote]);
+	u64 cold	= percpu_u64_get(&c->counters[BCH_COUNTER_read_nopromote_cold]);
+	u64 total	= hit + promoted + cold;
+
+	printbuf_tabstop_push(out, 24);
+
+	prt_printf(out, "hits:\t%llu\n", hit);
+	prt_printf(out, "promoted:\t%llu\n", promoted);
+	prt_printf(out, "not admitted:\t%llu\n", cold);
+	prt_printf(out, "hit rate:\t%llu%%\n", total ? div64_u64(hit * 100, total) : 0);
+}
+
 static inline int should_promote(struct bch_fs *c, struct bkey_s_c k,
 				  struct bpos pos,
+				  unsigned offset_into_extent,
+				  unsigned sectors,
 				  struct bch_io_opts opts,
 				  unsigned flags)
 {
@@ -99,12 +232,20 @@ static inline int should_promote(struct bch_fs *c, struct bkey_s_c k,
 	if (!(flags & BCH_READ_MAY_PROMOTE))
 		return -BCH_ERR_nopromote_may_not;
 
-	if (bch2_bkey_has_target(c, k, opts.promote_target))
+	if (bch2_bkey_has_target(c, k, opts.promote_target)) {
+		count_event(c, read_promote_hit);
 		return -BCH_ERR_nopromote_already_promoted;
+	}
 
 	if (bkey_extent_is_unwritten(k))
 		return -BCH_ERR_nopromote_unwritten;
 
+	if (promote_filter_read(c, k, offset_into_extent, sectors) <
+	    READ_ONCE(c->promote_min_reads)) {
+		count_event(c, read_nopromote_cold);
+		return -BCH_ERR_nopromote_cold;
+	}
+
 	if (bch2_target_congested(c, opts.promote_target))
 		return -BCH_ERR_nopromote_congested;
 
@@ -252,6 +393,7 @@ noinline
 static struct promote_op *promote_alloc(struct btree_trans *trans,
 					struct bvec_iter iter,
 					struct bkey_s_c k,
+					unsigned offset_into_extent,
 					struct extent_ptr_decoded *pick,
 					struct bch_io_opts opts,
 					unsigned flags,
@@ -271,7 +413,8 @@ static struct promote_op *promote_alloc(struct btree_trans *trans,
 	struct promote_op *promote;
 	int ret;
 
-	ret = should_promote(c, k, pos, opts, flags);
+	ret = should_promote(c, k, pos, offset_into_extent,
+			     bvec_iter_sectors(iter), opts, flags);
 	if (ret)
 		goto nopromote;
 
@@ -549,6 +692,7 @@ static void __bch2_read_endio(struct work_struct *work)
 	struct nonce nonce = extent_nonce(rbio->version, crc);
 	unsigned nofs_flags;
 	struct bch_csum csum;
+	bool decrypted;
 	int ret;
 
 	nofs_flags = memalloc_nofs_save();
@@ -562,7 +706,22 @@ static void __bch2_read_endio(struct work_struct *work)
 		src->bi_iter			= rbio->bvec_iter;
 	}
 
-	csum = bch2_checksum_bio(c, crc.csum_type, nonce, src);
+	/*
+	 * If we're going to decrypt everything we checksum, do both in a single
+	 * pass over the data - narrow_crcs and nodecode reads need the
+	 * ciphertext:
+	 */
+	decrypted = bch2_csum_type_is_encryption(crc.csum_type) &&
+		!rbio->narrow_crcs &&
+		!(rbio->flags & BCH_READ_NODECODE) &&
+		(crc_is_compressed(crc) ||
+		 (!crc.offset &&
+		  !rbio->offset_into_extent &&
+		  src->bi_iter.bi_size == dst_iter.bi_size));
+
+	csum = decrypted
+		? bch2_checksum_decrypt_bio(c, crc.csum_type, nonce, src)
+		: bch2_checksum_bio(c, crc.csum_type, nonce, src);
 	if (bch2_crc_cmp(csum, rbio->pick.crc.csum) && !c->opts.no_data_io)
 		goto csum_err;
 
@@ -584,7 +743,9 @@ static void __bch2_read_endio(struct work_struct *work)
 	crc.live_size	= bvec_iter_sectors(rbio->bvec_iter);
 
 	if (crc_is_compressed(crc)) {
-		ret = bch2_encrypt_bio(c, crc.csum_type, nonce, src);
+		ret = !decrypted
+			? bch2_encrypt_bio(c, crc.csum_type, nonce, src)
+			: 0;
 		if (ret)
 			goto decrypt_err;
 
@@ -599,7 +760,9 @@ static void __bch2_read_endio(struct work_struct *work)
 		BUG_ON(src->bi_iter.bi_size < dst_iter.bi_size);
 		src->bi_iter.bi_size = dst_iter.bi_size;
 
-		ret = bch2_encrypt_bio(c, crc.csum_type, nonce, src);
+		ret = !decrypted
+			? bch2_encrypt_bio(c, crc.csum_type, nonce, src)
+			: 0;
 		if (ret)
 			goto decrypt_err;
 
@@ -889,7 +1052,8 @@ int __bch2_read_extent(struct btree_trans *trans, struct bch_read_bio *orig,
 	}
 
 	if (orig->opts.promote_target)
-		promote = promote_alloc(trans, iter, k, &pick, orig->opts, flags,
+		promote = promote_alloc(trans, iter, k, offset_into_extent,
+					&pick, orig->opts, flags,
 					&rbio, &bounce, &read_full);
 
 	if (!read_full) {
@@ -993,9 +1157,11 @@ int __bch2_read_extent(struct btree_trans *trans, struct bch_read_bio *orig,
 
 	/*
 	 * If it's being moved internally, we don't want to flag it as a cache
-	 * hit:
+	 * hit; and a single read of an extent that's otherwise cold shouldn't
+	 * keep the rest of its bucket cached:
 	 */
-	if (pick.ptr.cached && !(flags & BCH_READ_NODECODE))
+	if (pick.ptr.cached && !(flags & BCH_READ_NODECODE) &&
+	    cached_extent_read(c, k))
 		bch2_bucket_io_time_reset(trans, pick.ptr.dev,
 			PTR_BUCKET_NR(ca, &pick.ptr), READ);
 
@@ -1199,6 +1365,9 @@ void bch2_fs_io_read_exit(struct bch_fs *c)
 {
 	if (c->promote_table.tbl)
 		rhashtable_destroy(&c->promote_table);
+	kvfree(c->cache_heat);
+	kvfree(c->promote_streams);
+	kvfree(c->promote_filter);
 	bioset_exit(&c->bio_read_split);
 	bioset_exit(&c->bio_read);
 }
@@ -1216,5 +1385,11 @@ int bch2_fs_io_read_init(struct bch_fs *c)
 	if (rhashtable_init(&c->promote_table, &bch_promote_params))
 		return -BCH_ERR_ENOMEM_promote_table_init;
 
+	c->promote_filter	= kvzalloc(READ_SKETCH_SIZE, GFP_KERNEL);
+	c->promote_streams	= kvcalloc(READ_STREAM_SIZE, sizeof(u64), GFP_KERNEL);
+	c->cache_heat		= kvzalloc(READ_SKETCH_SIZE, GFP_KERNEL);
+	if (!c->promote_filter || !c->promote_streams || !c->cache_heat)
+		return -BCH_ERR_ENOMEM_promote_filter_init;
+
 	return 0;
 }
@@ -152,6 +152,9 @@ static inline struct bch_read_bio *rbio_init(struct bio *bio,
 	return rbio;
 }
 
+bool bch2_cached_extent_hot(struct bch_fs *, struct bkey_s_c);
+void bch2_promote_stats_to_text(struct printbuf *, struct bch_fs *);
+
 void bch2_fs_io_read_exit(struct bch_fs *);
 int bch2_fs_io_read_init(struct bch_fs *);
 
@@ -27,6 +27,7 @@
 #include "trace.h"
 
 #include <linux/ioprio.h>
+#include <linux/jhash.h>
 #include <linux/kthread.h>
 
 const char * const bch2_data_ops_strs[] = {
@@ -102,6 +103,16 @@ struct moving_io {
 	unsigned			read_sectors;
 	unsigned			write_sectors;
 
+	/*
+	 * If another job wants to move the same extent while our read is in
+	 * flight, it doesn't issue its own read: it's put on our coalesce_list
+	 * and gets a copy of the data we read (see move_coalesce_join()):
+	 */
+	bool				coalesce_open;
+	struct hlist_node		coalesce_hash;
+	struct list_head		coalesce_list;
+	struct work_struct		coalesce_work;
+
 	struct bch_read_bio		rbio;
 
 	struct data_update		write;
@@ -171,9 +182,8 @@ struct moving_io *bch2_moving_ctxt_next_pending_write(struct moving_context *ctx
 	return io && io->read_completed ? io : NULL;
 }
 
-static void move_read_endio(struct bio *bio)
+static void move_read_done(struct moving_io *io)
 {
-	struct moving_io *io = container_of(bio, struct moving_io, rbio.bio);
 	struct moving_context *ctxt = io->write.ctxt;
 
 	atomic_sub(io->read_sectors, &ctxt->read_sectors);
@@ -184,6 +194,105 @@ static void move_read_endio(struct bio *bio)
 	closure_put(&ctxt->cl);
 }
 
+/* Move coalescing: */
+
+static u64 move_coalesce_hash(enum btree_id btree, struct bpos pos)
+{
+	return jhash(&pos, sizeof(pos), btree);
+}
+
+/*
+ * A move may piggyback on another move of the exact same key (so the data it
+ * reads is what we'd read) as long as they don't both rewrite the same
+ * pointer - one of them would just lose the race in the index update:
+ */
+static struct moving_io *move_coalesce_find(struct bch_fs *c, struct moving_io *io)
+{
+	struct bkey_i *k = io->write.k.k;
+	struct moving_io *i;
+
+	hash_for_each_possible(c->move_coalesce_table, i, coalesce_hash,
+			       move_coalesce_hash(io->write.btree_id, k->k.p))
+		if (i->write.btree_id == io->write.btree_id &&
+		    bkey_bytes(&i->write.k.k->k) == bkey_bytes(&k->k) &&
+		    !memcmp(i->write.k.k, k, bkey_bytes(&k->k)) &&
+		    !(i->write.data_opts.rewrite_ptrs & io->write.data_opts.rewrite_ptrs))
+			return i;
+	return NULL;
+}
+
+/*
+ * Returns true if @io was attached to an in flight move of the same extent and
+ * must not issue its own read; otherwise, other moves may now attach to @io:
+ */
+static bool move_coalesce_join(struct bch_fs *c, struct moving_io *io)
+{
+	struct moving_io *leader;
+	unsigned long flags;
+
+	spin_lock_irqsave(&c->move_coalesce_lock, flags);
+	leader = move_coalesce_find(c, io);
+	if (leader) {
+		list_add_tail(&io->coalesce_list, &leader->coalesce_list);
+	} else {
+		io->coalesce_open = true;
+		hash_add(c->move_coalesce_table, &io->coalesce_hash,
+			 move_coalesce_hash(io->write.btree_id, io->write.k.k->k.p));
+	}
+	spin_unlock_irqrestore(&c->move_coalesce_lock, flags);
+
+	return leader != NULL;
+}
+
+/*
+ * Runs before the leader's read is marked completed, so the leader's write
+ * (which may modify its buffer in place) can't have started yet:
+ */
+static void move_coalesce_work(struct work_struct *work)
+{
+	struct moving_io *io = container_of(work, struct moving_io, coalesce_work);
+	struct moving_io *f, *n;
+
+	list_for_each_entry_safe(f, n, &io->coalesce_list, coalesce_list) {
+		list_del_init(&f->coalesce_list);
+
+		f->rbio.pick		= io->rbio.pick;
+		f->rbio.hole		= io->rbio.hole;
+		f->rbio.bio.bi_status	= io->rbio.bio.bi_status;
+
+		if (!f->rbio.bio.bi_status && !f->rbio.hole)
+			bio_copy_data(&f->write.op.wbio.bio, &io->write.op.wbio.bio);
+
+		move_read_done(f);
+	}
+
+	move_read_done(io);
+}
+
+static void move_read_endio(struct bio *bio)
+{
+	struct moving_io *io = container_of(bio, struct moving_io, rbio.bio);
+
+	if (io->coalesce_open) {
+		struct bch_fs *c = io->rbio.c;
+		unsigned long flags;
+		bool followers;
+
+		spin_lock_irqsave(&c->move_coalesce_lock, flags);
+		hash_del(&io->coalesce_hash);
+		io->coalesce_open = false;
+		followers = !list_empty(&io->coalesce_list);
+		spin_unlock_irqrestore(&c->move_coalesce_lock, flags);
+
+		if (followers) {
+			queue_work(c->io_complete_wq, &io->coalesce_work);
+			return;
+		}
+	}
+
+	move_read_done(io);
+}
+
 void bch2_moving_ctxt_do_pending_writes(struct moving_context *ctxt)
 {
 	struct moving_io *io;
@@ -270,6 +379,42 @@ void bch2_move_stats_init(struct bch_move_stats *stats, const char *name)
 	scnprintf(stats->name, sizeof(stats->name), "%s", name);
 }
 
+/*
+ * @sectors is the total moved so far by this job (sectors_base plus whatever
+ * the current move_stats say); the rate is resampled at most once a second:
+ */
+void bch2_move_progress_update(struct bch_move_progress *p, u64 sectors)
+{
+	unsigned long now = jiffies;
+
+	p->sectors_done = sectors;
+
+	if (!p->last_update) {
+		p->last_update	= now;
+		p->last_sectors	= sectors;
+		return;
+	}
+
+	if (time_before(now, p->last_update + HZ))
+		return;
+
+	u64 rate = div64_u64((sectors - p->last_sectors) * HZ,
+			     now - p->last_update);
+
+	p->rate		= p->rate ? ewma_add(p->rate, rate, 2) : rate;
+	p->last_update	= now;
+	p->last_sectors	= sectors;
+}
+
+u64 bch2_move_progress_eta(struct bch_move_progress *p, u64 pending)
+{
+	u64 rate = READ_ONCE(p->rate);
+
+	if (!pending)
+		return 0;
+	return rate ? div64_u64(pending, rate) : U64_MAX;
+}
+
 int bch2_move_extent(struct moving_context *ctxt,
 		     struct move_bucket_in_flight *bucket_in_flight,
 		     struct btree_iter *iter,
@@ -317,6 +462,8 @@ int bch2_move_extent(struct moving_context *ctxt,
 		goto err;
 
 	INIT_LIST_HEAD(&io->io_list);
+	INIT_LIST_HEAD(&io->coalesce_list);
+	INIT_WORK(&io->coalesce_work, move_coalesce_work);
 	io->write.ctxt		= ctxt;
 	io->read_sectors	= k.k->size;
 	io->write_sectors	= k.k->size;
@@ -361,8 +508,6 @@ int bch2_move_extent(struct moving_context *ctxt,
 	}
 
 	this_cpu_add(c->counters[BCH_COUNTER_io_move], k.k->size);
-	this_cpu_add(c->counters[BCH_COUNTER_move_extent_read], k.k->size);
-	trace_move_extent_read2(c, k);
 
 	mutex_lock(&ctxt->lock);
 	atomic_add(io->read_sectors, &ctxt->read_sectors);
@@ -373,10 +518,19 @@ int bch2_move_extent(struct moving_context *ctxt,
 	mutex_unlock(&ctxt->lock);
 
 	/*
-	 * dropped by move_read_endio() - guards against use after free of
+	 * dropped by move_read_done() - guards against use after free of
 	 * ctxt when doing wakeup
 	 */
 	closure_get(&ctxt->cl);
+
+	if (move_coalesce_join(c, io)) {
+		count_event(c, move_extent_coalesced);
+		return 0;
+	}
+
+	this_cpu_add(c->counters[BCH_COUNTER_move_extent_read], k.k->size);
+	trace_move_extent_read2(c, k);
+
 	bch2_read_extent(trans, &io->rbio,
 			 bkey_start_pos(k.k),
 			 iter->btree_id, k, 0,
@@ -741,6 +895,10 @@ int bch2_evacuate_bucket(struct moving_context *ctxt,
 			break;
 
 		if (!bp.level) {
+			/* stripes aren't moved by data updates: */
+			if (bp.btree_id == BTREE_ID_stripes)
+				goto next;
+
 			k = bch2_backpointer_get_key(trans, &iter, bp_pos, bp, 0);
 			ret = bkey_err(k);
 			if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
@@ -832,6 +990,168 @@ int bch2_evacuate_bucket(struct moving_context *ctxt,
 	return ret;
 }
 
+/* Hot cached data: */
+
+/* Returns the index of @k's cached pointer into @bucket, if @k is hot: */
+static int hot_cached_ptr_idx(struct bch_fs *c, struct bkey_s_c k,
+			      struct bpos bucket)
+{
+	unsigned i = 0;
+
+	if (!bch2_cached_extent_hot(c, k))
+		return -1;
+
+	bkey_for_each_ptr(bch2_bkey_ptrs_c(k), ptr) {
+		if (ptr->cached &&
+		    ptr->dev == bucket.inode &&
+		    bpos_eq(PTR_BUCKET_POS(c, ptr), bucket))
+			return i;
+		i++;
+	}
+
+	return -1;
+}
+
+/*
+ * Does this cached bucket contain any extents that are still being read? Only
+ * a heuristic: backpointers still in the write buffer aren't seen.
+ */
+int bch2_bucket_has_hot_cached(struct btree_trans *trans, struct bpos bucket, int gen)
+{
+	struct bch_fs *c = trans->c;
+	struct bpos bp_pos = POS_MIN;
+	struct bch_backpointer bp;
+	int ret = 0;
+
+	if (!READ_ONCE(c->cache_hot_reads))
+		return 0;
+
+	while (!(ret = bch2_get_next_backpointer(trans, bucket, gen,
+						 &bp_pos, &bp, BTREE_ITER_CACHED)) &&
+	       !bkey_eq(bp_pos, POS_MAX)) {
+		if (!bp.level) {
+			struct btree_iter iter;
+			struct bkey_s_c k = bch2_backpointer_get_key(trans, &iter, bp_pos, bp, 0);
+			ret = bkey_err(k);
+			if (ret)
+				break;
+			if (k.k) {
+				ret = hot_cached_ptr_idx(c, k, bucket) >= 0;
+				bch2_trans_iter_exit(trans, &iter);
+				if (ret)
+					break;
+			}
+		}
+
+		bp_pos = bpos_nosnap_successor(bp_pos);
+	}
+
+	return ret;
+}
+
+/*
+ * Called before invalidating a cached bucket that still has hot extents in it:
+ * write new cached copies of those extents to the promote target, so that the
+ * cold data they share the bucket with can be evicted without losing them.
+ */
+int bch2_bucket_rescue_hot_cached(struct bch_fs *c, struct bpos bucket)
+{
+	struct moving_context ctxt;
+	struct btree_trans *trans;
+	struct btree_iter iter;
+	struct bkey_buf sk;
+	struct bch_backpointer bp;
+	struct bch_alloc_v4 a_convert;
+	const struct bch_alloc_v4 *a;
+	struct bkey_s_c k;
+	struct bch_io_opts io_opts;
+	struct bpos bp_pos = POS_MIN;
+	int gen, ret = 0;
+
+	bch2_bkey_buf_init(&sk);
+	bch2_moving_ctxt_init(&ctxt, c, NULL, NULL,
+			      writepoint_hashed((unsigned long) current),
+			      false);
+	trans = ctxt.trans;
+
+	bch2_trans_iter_init(trans, &iter, BTREE_ID_alloc,
+			     bucket, BTREE_ITER_CACHED);
+	ret = lockrestart_do(trans,
+			bkey_err(k = bch2_btree_iter_peek_slot(&iter)));
+	bch2_trans_iter_exit(trans, &iter);
+	if (ret)
+		goto err;
+
+	a = bch2_alloc_to_v4(k, &a_convert);
+	if (a->data_type != BCH_DATA_cached)
+		goto err;
+
+	gen = a->gen;
+
+	while (1) {
+		bch2_trans_begin(trans);
+
+		ret = bch2_get_next_backpointer(trans, bucket, gen,
+						&bp_pos, &bp,
+						BTREE_ITER_CACHED);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		if (ret)
+			goto err;
+		if (bkey_eq(bp_pos, POS_MAX))
+			break;
+
+		if (bp.level)
+			goto next;
+
+		k = bch2_backpointer_get_key(trans, &iter, bp_pos, bp, 0);
+		ret = bkey_err(k);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		if (ret)
+			goto err;
+		if (!k.k)
+			goto next;
+
+		bch2_bkey_buf_reassemble(&sk, c, k);
+		k = bkey_i_to_s_c(sk.k);
+
+		ret = bch2_move_get_io_opts_one(trans, &io_opts, k);
+		if (ret ||
+		    !io_opts.promote_target ||
+		    hot_cached_ptr_idx(c, k, bucket) < 0) {
+			bch2_trans_iter_exit(trans, &iter);
+			if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+				continue;
+			ret = 0;
+			goto next;
+		}
+
+		ret = bch2_move_extent(&ctxt, NULL, &iter, k, io_opts,
+				(struct data_update_opts) {
+					.target		= io_opts.promote_target,
+					.extra_replicas	= 1,
+					.write_flags	= BCH_WRITE_ALLOC_NOWAIT|BCH_WRITE_CACHED,
+					.rescue		= true,
+				});
+		bch2_trans_iter_exit(trans, &iter);
+
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		/*
+		 * Best effort - if we can't move it, it's just evicted; the
+		 * rescue is counted when the new copy is added to the extent:
+		 */
+		ret = 0;
+next:
+		bp_pos = bpos_nosnap_successor(bp_pos);
+	}
+err:
+	bch2_moving_ctxt_exit(&ctxt);
+	bch2_bkey_buf_exit(&sk, c);
+	return ret;
+}
+
 typedef bool (*move_btree_pred)(struct bch_fs *, void *,
 				struct btree *, struct bch_io_opts *,
 				struct data_update_opts *);
@@ -1065,6 +1385,446 @@ static bool drop_extra_replicas_btree_pred(struct bch_fs *c, void *arg,
 	return drop_extra_replicas_pred(c, arg, bkey_i_to_s_c(&b->key), io_opts, data_opts);
 }
 
+/* Physical order walks, for scrub and migrate: */
+
+/* Returns 1 if there's another bucket with data at or after @bucket: */
+static int dev_next_dirty_bucket(struct btree_trans *trans, struct bch_dev *ca,
+				 struct bpos *bucket, u8 *gen)
+{
+	return for_each_btree_key_upto(trans, iter, BTREE_ID_alloc, *bucket,
+				       POS(ca->dev_idx, ca->mi.nbuckets - 1),
+				       BTREE_ITER_PREFETCH, k, ({
+		struct bch_alloc_v4 a_convert;
+		const struct bch_alloc_v4 *a = bch2_alloc_to_v4(k, &a_convert);
+		bool found = bch2_bucket_sectors_dirty(*a) != 0;
+
+		if (found) {
+			*bucket	= k.k->p;
+			*gen	= a->gen;
+		}
+		found;
+	}));
+}
+
+/* Scrub: */
+
+static bool scrub_dev_congested(struct bch_dev *ca)
+{
+#ifndef CONFIG_BCACHEFS_NO_LATENCY_ACCT
+	u64 now = local_clock(), last = READ_ONCE(ca->congested_last);
+	s64 congested = atomic_read(&ca->congested);
+
+	if (time_after64(now, last))
+		congested -= (now - last) >> 12;
+
+	return congested > 0;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Scrub yields to foreground IO: besides the (optional) rate limit, we back off
+ * while the device is seeing higher than normal latencies:
+ */
+static int scrub_throttle(struct moving_context *ctxt, struct bch_dev *ca)
+{
+	int ret;
+
+	while (!(ret = bch2_move_ratelimit(ctxt)) &&
+	       scrub_dev_congested(ca))
+		move_ctxt_wait_event_timeout(ctxt, kthread_should_stop(), HZ / 10);
+
+	return ret;
+}
+
+static int scrub_read(struct moving_context *ctxt, struct bch_dev *ca,
+		      u64 offset, unsigned sectors, void *buf)
+{
+	struct bio *bio;
+	int ret;
+
+	if (!bch2_dev_get_ioref(ca, READ))
+		return -BCH_ERR_scrub_dev_offline;
+
+	bio = bio_alloc(ca->disk_sb.bdev, buf_pages(buf, sectors << 9),
+			REQ_OP_READ, GFP_KERNEL);
+	bio_set_prio(bio, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+	bio->bi_iter.bi_sector = offset;
+	bch2_bio_map(bio, buf, sectors << 9);
+
+	ret = submit_bio_wait(bio);
+	bio_put(bio);
+	percpu_ref_put(&ca->io_ref);
+
+	if (ctxt->rate)
+		bch2_ratelimit_increment(ctxt->rate, sectors);
+	if (ret)
+		bch2_io_error(ca, BCH_MEMBER_ERROR_read);
+	return ret;
+}
+
+static int scrub_extent_ptr(struct moving_context *ctxt, struct bch_dev *ca,
+			    struct bkey_s_c k, struct extent_ptr_decoded p,
+			    bool *bad)
+{
+	struct bch_fs *c = ctxt->trans->c;
+	unsigned bytes = p.crc.compressed_size << 9;
+	void *buf = kvmalloc(bytes, GFP_KERNEL);
+	int ret;
+
+	if (!buf)
+		return -ENOMEM;
+
+	ret = scrub_read(ctxt, ca, p.ptr.offset, p.crc.compressed_size, buf);
+	if (ret == -BCH_ERR_scrub_dev_offline)
+		goto out;
+	if (ret) {
+		*bad = true;
+		ret = 0;
+		goto out;
+	}
+
+	if (bch2_csum_type_is_encryption(p.crc.csum_type) && !c->chacha20)
+		goto out;
+
+	if (p.crc.csum_type &&
+	    bch2_crc_cmp(p.crc.csum,
+			 bch2_checksum(c, p.crc.csum_type,
+				       extent_nonce(k.k->version, p.crc),
+				       buf, bytes))) {
+		/*
+		 * We read without btree locks held: if the extent was moved
+		 * and the bucket reused, the data we read isn't this extent's:
+		 */
+		if (ptr_stale(ca, &p.ptr))
+			goto out;
+
+		bch2_io_error(ca, BCH_MEMBER_ERROR_checksum);
+		*bad = true;
+	}
+out:
+	kvfree(buf);
+	return ret;
+}
+
+/* Data blocks are checked via the extents that point into them: */
+static int scrub_stripe_parity(struct moving_context *ctxt, struct bch_dev *ca,
+			       struct bkey_s_c k, unsigned block, bool *bad)
+{
+	struct bch_fs *c = ctxt->trans->c;
+	struct bch_stripe *v = (struct bch_stripe *) bkey_s_c_to_stripe(k).v;
+	unsigned granularity	= 1U << v->csum_granularity_bits;
+	unsigned sectors	= le16_to_cpu(v->sectors);
+	void *buf = kvmalloc(min(granularity, sectors) << 9, GFP_KERNEL);
+	int ret = 0;
+
+	if (!buf)
+		return -ENOMEM;
+
+	for (unsigned offset = 0; offset < sectors && !*bad; offset += granularity) {
+		unsigned len = min(granularity, sectors - offset);
+
+		ret = scrub_read(ctxt, ca, v->ptrs[block].offset + offset, len, buf);
+		if (ret == -BCH_ERR_scrub_dev_offline)
+			break;
+		if (ret) {
+			*bad = true;
+			ret = 0;
+			break;
+		}
+
+		if (v->csum_type &&
+		    bch2_crc_cmp(stripe_csum_get(v, block, offset >> v->csum_granularity_bits),
+				 bch2_checksum(c, v->csum_type, null_nonce(), buf, len << 9))) {
+			if (ptr_stale(ca, &v->ptrs[block]))
+				break;
+
+			bch2_io_error(ca, BCH_MEMBER_ERROR_checksum);
+			*bad = true;
+		}
+	}
+
+	kvfree(buf);
+	return ret;
+}
+
+static bool scrub_key_eq(struct bkey_s_c l, struct bkey_i *r)
+{
+	return bkey_bytes(l.k) == bkey_bytes(&r->k) &&
+		!memcmp(l.k, &r->k, sizeof(*l.k)) &&
+		!memcmp(l.v, &r->v, bkey_val_bytes(l.k));
+}
+
+/*
+ * Rewrite the bad pointer: the read path skips replicas that fail their
+ * checksum (or reconstructs from the stripe), so the new replica is written
+ * from a good copy. The data update counts the sectors as corrected once the
+ * new replica is written and the extent updated.
+ *
+ * Returns 1 if the extent changed since we read it, i.e. the bad replica is no
+ * longer referenced:
+ */
+static int scrub_repair_extent(struct moving_context *ctxt, enum btree_id btree,
+			       struct bkey_i *old, unsigned ptr_idx)
+{
+	struct btree_trans *trans = ctxt->trans;
+	struct bch_io_opts io_opts;
+	struct data_update_opts data_opts = {
+		.rewrite_ptrs	= BIT(ptr_idx),
+		.scrub		= true,
+	};
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	int ret;
+
+	bch2_trans_node_iter_init(trans, &iter, btree, old->k.p, 0, 0, 0);
+	k = bch2_btree_iter_peek_slot(&iter);
+	ret = bkey_err(k);
+	if (ret)
+		goto err;
+
+	/* raced with the extent being overwritten or moved: */
+	if (!scrub_key_eq(k, old)) {
+		ret = 1;
+		goto err;
+	}
+
+	ret = bch2_move_get_io_opts_one(trans, &io_opts, k);
+	if (ret)
+		goto err;
+
+	/* a repair shouldn't move data anywhere else: */
+	data_opts.target = 0;
+
+	ret = bch2_move_extent(ctxt, NULL, &iter, k, io_opts, data_opts);
+err:
+	bch2_trans_iter_exit(trans, &iter);
+	return ret;
+}
+
+static void scrub_err_msg(struct bch_fs *c, struct bch_dev *ca,
+			  struct bkey_s_c k, bool repairing)
+{
+	struct printbuf buf = PRINTBUF;
+
+	bch2_bkey_val_to_text(&buf, c, k);
+	bch_err_ratelimited(c, "scrub: error on %s in\n  %s\n  %s",
+			    ca->name, buf.buf,
+			    repairing ? "repairing" : "no good copy to repair from");
+	printbuf_exit(&buf);
+}
+
+static int scrub_key(struct moving_context *ctxt, struct bch_dev *ca,
+		     struct bpos bucket, enum btree_id btree,
+		     struct bkey_buf *sk, u64 *last_offset)
+{
+	struct bch_fs *c = ctxt->trans->c;
+	struct bch_move_stats *stats = ctxt->stats;
+	struct bkey_s_c k = bkey_i_to_s_c(sk->k);
+	bool bad = false;
+	int ret = 0;
+
+	if (k.k->type == KEY_TYPE_stripe) {
+		const struct bch_stripe *v = bkey_s_c_to_stripe(k).v;
+
+		for (unsigned i = v->nr_blocks - v->nr_redundant; i < v->nr_blocks; i++)
+			if (v->ptrs[i].dev == ca->dev_idx &&
+			    bpos_eq(PTR_BUCKET_POS(c, &v->ptrs[i]), bucket)) {
+				ret = scrub_stripe_parity(ctxt, ca, k, i, &bad);
+				if (ret)
+					return ret;
+
+				atomic64_add(le16_to_cpu(v->sectors), &stats->sectors_seen);
+				if (bad) {
+					/* parity is rebuilt when the stripe is rewritten, not here: */
+					scrub_err_msg(c, ca, k, false);
+					atomic64_add(le16_to_cpu(v->sectors),
+						     &stats->sectors_error_uncorrected);
+				}
+			}
+		return 0;
+	}
+
+	struct bkey_ptrs_c ptrs = bch2_bkey_ptrs_c(k);
+	const union bch_extent_entry *entry;
+	struct extent_ptr_decoded p;
+	unsigned i = 0;
+
+	bkey_for_each_ptr_decode(k.k, ptrs, p, entry) {
+		if (p.ptr.cached ||
+		    p.ptr.dev != ca->dev_idx ||
+		    !bpos_eq(PTR_BUCKET_POS(c, &p.ptr), bucket)) {
+			i++;
+			continue;
+		}
+
+		/* extents that were partially overwritten share checksummed regions: */
+		if (p.ptr.offset == *last_offset)
+			return 0;
+		*last_offset = p.ptr.offset;
+
+		ret = scrub_extent_ptr(ctxt, ca, k, p, &bad);
+		if (ret)
+			return ret;
+
+		atomic64_add(p.crc.compressed_size, &stats->sectors_seen);
+		if (!bad)
+			return 0;
+
+		bool have_good_copy = p.has_ec ||
+			bch2_bkey_durability(c, k) > bch2_extent_ptr_durability(c, &p);
+
+		scrub_err_msg(c, ca, k, have_good_copy);
+
+		if (have_good_copy) {
+			ret = lockrestart_do(ctxt->trans,
+					scrub_repair_extent(ctxt, btree, sk->k, i));
+			if (ret >= 0)
+				return 0;
+			if (bch2_err_matches(ret, EROFS))
+				return ret;
+			ret = 0;
+		}
+
+		atomic64_add(p.crc.compressed_size, &stats->sectors_error_uncorrected);
+		return 0;
+	}
+
+	return 0;
+}
+
+static int scrub_bucket(struct moving_context *ctxt, struct bch_dev *ca,
+			struct bpos bucket, int gen)
+{
+	struct btree_trans *trans = ctxt->trans;
+	struct bch_fs *c = trans->c;
+	struct btree_iter iter;
+	struct bkey_buf sk;
+	struct bch_backpointer bp;
+	struct bpos bp_pos = POS_MIN;
+	u64 last_offset = U64_MAX;
+	int ret = 0;
+
+	bch2_bkey_buf_init(&sk);
+
+	while (!(ret = scrub_throttle(ctxt, ca))) {
+		bch2_trans_begin(trans);
+
+		ret = bch2_get_next_backpointer(trans, bucket, gen,
+						&bp_pos, &bp,
+						BTREE_ITER_CACHED);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		if (ret)
+			break;
+		if (bkey_eq(bp_pos, POS_MAX))
+			break;
+
+		/* btree nodes are checksummed and verified every time they're read */
+		if (bp.level)
+			goto next;
+
+		struct bkey_s_c k = bch2_backpointer_get_key(trans, &iter, bp_pos, bp, 0);
+		ret = bkey_err(k);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		if (ret)
+			break;
+		if (!k.k)
+			goto next;
+
+		bch2_bkey_buf_reassemble(&sk, c, k);
+		bch2_trans_iter_exit(trans, &iter);
+		bch2_trans_unlock_long(trans);
+
+		ret = scrub_key(ctxt, ca, bucket, bp.btree_id, &sk, &last_offset);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			continue;
+		if (ret)
+			break;
+next:
+		bp_pos = bpos_nosnap_successor(bp_pos);
+	}
+
+	bch2_bkey_buf_exit(&sk, c);
+	return ret;
+}
+
+/*
+ * Scrub a device: walk its buckets in order, and within each bucket its
+ * backpointers (which are sorted by offset), so reads are issued in roughly
+ * physical order:
+ */
+static int bch2_scrub_dev(struct bch_fs *c, struct bch_move_stats *stats,
+			  struct bch_ioctl_data op)
+{
+	struct bch_dev *ca = bch_dev_bkey_exists(c, op.scrub.dev);
+	struct bch_ratelimit rate = { .rate = op.scrub.rate };
+	struct moving_context ctxt;
+	struct bpos bucket = POS(ca->dev_idx, ca->mi.first_bucket);
+	u8 gen;
+	int ret;
+
+	bch2_ratelimit_reset(&rate);
+	bch2_moving_ctxt_init(&ctxt, c, op.scrub.rate ? &rate : NULL, stats,
+			      writepoint_hashed((unsigned long) current),
+			      true);
+	stats->data_type = BCH_DATA_user;
+
+	ret = bch2_btree_write_buffer_flush_sync(ctxt.trans);
+
+	while (!ret &&
+	       !kthread_should_stop() &&
+	       (ret = dev_next_dirty_bucket(ctxt.trans, ca, &bucket, &gen)) == 1) {
+		stats->pos = BBPOS(BTREE_ID_alloc, bucket);
+
+		ret = scrub_bucket(&ctxt, ca, bucket, gen);
+		bucket = bpos_nosnap_successor(bucket);
+	}
+
+	bch2_moving_ctxt_exit(&ctxt);
+	ret = ret > 0 ? 0 : ret;
+	bch_err_fn(c, ret);
+	return ret;
+}
+
+/*
+ * Migrate in physical order: evacuate the device's buckets in order, finding
+ * the extents that live in each bucket via backpointers - reads from the
+ * device being evacuated are then mostly sequential, instead of in extents
+ * btree order:
+ */
+static int bch2_migrate_dev_physical(struct bch_fs *c, struct bch_move_stats *stats,
+				     struct bch_ioctl_data op)
+{
+	struct bch_dev *ca = bch_dev_bkey_exists(c, op.migrate.dev);
+	struct moving_context ctxt;
+	struct bpos bucket = POS(ca->dev_idx, ca->mi.first_bucket);
+	u8 gen;
+	int ret = 0;
+
+	bch2_moving_ctxt_init(&ctxt, c, NULL, stats,
+			      writepoint_hashed((unsigned long) current),
+			      true);
+	stats->data_type = BCH_DATA_user;
+
+	while (!ret &&
+	       !kthread_should_stop() &&
+	       (ret = dev_next_dirty_bucket(ctxt.trans, ca, &bucket, &gen)) == 1) {
+		stats->pos = BBPOS(BTREE_ID_alloc, bucket);
+
+		ret = bch2_evacuate_bucket(&ctxt, NULL, bucket, gen,
+					   (struct data_update_opts) { 0 });
+		bucket = bpos_nosnap_successor(bucket);
+	}
+
+	bch2_moving_ctxt_exit(&ctxt);
+	ret = ret > 0 ? 0 : ret;
+	bch_err_fn(c, ret);
+	return ret;
+}
+
 int bch2_data_job(struct bch_fs *c,
 		  struct bch_move_stats *stats,
 		  struct bch_ioctl_data op)
@@ -1079,6 +1839,13 @@ int bch2_data_job(struct bch_fs *c,
 	bch2_move_stats_init(stats, bch2_data_ops_strs[op.op]);
 
 	switch (op.op) {
+	case BCH_DATA_OP_scrub:
+		if (op.scrub.dev >= c->sb.nr_devices ||
+		    !bch2_dev_exists2(c, op.scrub.dev))
+			return -EINVAL;
+
+		ret = bch2_scrub_dev(c, stats, op);
+		break;
 	case BCH_DATA_OP_rereplicate:
 		stats->data_type = BCH_DATA_journal;
 		ret = bch2_journal_flush_device_pins(&c->journal, -1);
@@ -1100,12 +1867,14 @@ int bch2_data_job(struct bch_fs *c,
 		ret = bch2_journal_flush_device_pins(&c->journal, op.migrate.dev);
 		ret = bch2_move_btree(c, start, end,
 				      migrate_btree_pred, &op, stats) ?: ret;
-		ret = bch2_move_data(c, start, end,
+		ret = (op.flags & BCH_DATA_PHYSICAL_ORDER
+		       ? bch2_migrate_dev_physical(c, stats, op)
+		       : bch2_move_data(c, start, end,
 				     NULL,
 				     stats,
 				     writepoint_hashed((unsigned long) current),
 				     true,
-				     migrate_pred, &op) ?: ret;
+				     migrate_pred, &op)) ?: ret;
 		ret = bch2_replicas_gc2(c) ?: ret;
 		break;
 	case BCH_DATA_OP_rewrite_old_nodes:
@@ -1157,6 +1926,17 @@ void bch2_move_stats_to_text(struct printbuf *out, struct bch_move_stats *stats)
 	prt_human_readable_u64(out, atomic64_read(&stats->sectors_raced) << 9);
 	prt_newline(out);
 
+	if (atomic64_read(&stats->sectors_error_corrected) ||
+	    atomic64_read(&stats->sectors_error_uncorrected)) {
+		prt_str(out, "bytes corrected:   ");
+		prt_human_readable_u64(out, atomic64_read(&stats->sectors_error_corrected) << 9);
+		prt_newline(out);
+
+		prt_str(out, "bytes uncorrected: ");
+		prt_human_readable_u64(out, atomic64_read(&stats->sectors_error_uncorrected) << 9);
+		prt_newline(out);
+	}
+
 	printbuf_indent_sub(out, 2);
 }
 
@@ -1205,4 +1985,7 @@ void bch2_fs_move_init(struct bch_fs *c)
 {
 	INIT_LIST_HEAD(&c->moving_context_list);
 	mutex_init(&c->moving_context_lock);
+
+	spin_lock_init(&c->move_coalesce_lock);
+	hash_init(c->move_coalesce_table);
 }
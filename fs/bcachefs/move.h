@@ -140,6 +140,8 @@ int bch2_evacuate_bucket(struct moving_context *,
 			   struct move_bucket_in_flight *,
 			   struct bpos, int,
 			   struct data_update_opts);
+int bch2_bucket_has_hot_cached(struct btree_trans *, struct bpos, int);
+int bch2_bucket_rescue_hot_cached(struct bch_fs *, struct bpos);
 int bch2_data_job(struct bch_fs *,
 		  struct bch_move_stats *,
 		  struct bch_ioctl_data);
@@ -148,6 +150,9 @@ void bch2_move_stats_to_text(struct printbuf *, struct bch_move_stats *);
 void bch2_move_stats_exit(struct bch_move_stats *, struct bch_fs *);
 void bch2_move_stats_init(struct bch_move_stats *, const char *);
 
+void bch2_move_progress_update(struct bch_move_progress *, u64);
+u64 bch2_move_progress_eta(struct bch_move_progress *, u64);
+
 void bch2_fs_moving_ctxts_to_text(struct printbuf *, struct bch_fs *);
 
 void bch2_fs_move_init(struct bch_fs *);
@@ -14,6 +14,24 @@ struct bch_move_stats {
 	atomic64_t		sectors_seen;
 	atomic64_t		sectors_moved;
 	atomic64_t		sectors_raced;
+
+	/* scrub: */
+	atomic64_t		sectors_error_corrected;
+	atomic64_t		sectors_error_uncorrected;
+};
+
+/*
+ * Throughput of a long running background job (rebalance, copygc), for
+ * estimating how long its outstanding work will take:
+ */
+struct bch_move_progress {
+	/* sectors moved by previous passes, whose move_stats were reset: */
+	u64			sectors_base;
+	u64			sectors_done;
+	u64			last_sectors;
+	unsigned long		last_update;
+	/* sectors/sec, smoothed */
+	u64			rate;
 };
 
 struct move_bucket_key {
@@ -286,6 +286,22 @@ unsigned long bch2_copygc_wait_amount(struct bch_fs *c)
 	return wait;
 }
 
+/* Fragmented space copygc may eventually have to reclaim, on rw devices: */
+u64 bch2_copygc_fragmented(struct bch_fs *c)
+{
+	u64 fragmented = 0;
+
+	for_each_rw_member(c, ca) {
+		struct bch_dev_usage usage = bch2_dev_usage_read(ca);
+
+		for (unsigned i = 0; i < BCH_DATA_NR; i++)
+			if (data_type_movable(i))
+				fragmented += usage.d[i].fragmented;
+	}
+
+	return fragmented;
+}
+
 void bch2_copygc_wait_to_text(struct printbuf *out, struct bch_fs *c)
 {
 	prt_printf(out, "Currently waiting for:     ");
@@ -327,6 +343,7 @@ static int bch2_copygc_thread(void *arg)
 	set_freezable();
 
 	bch2_move_stats_init(&move_stats, "copygc");
+	c->copygc_progress.sectors_base = c->copygc_progress.sectors_done;
 	bch2_moving_ctxt_init(&ctxt, c, NULL, &move_stats,
 			      writepoint_ptr(&c->copygc_write_point),
 			      false);
@@ -370,6 +387,10 @@ static int bch2_copygc_thread(void *arg)
 
 		wake_up(&c->copygc_running_wq);
 
+		bch2_move_progress_update(&c->copygc_progress,
+					  c->copygc_progress.sectors_base +
+					  atomic64_read(&move_stats.sectors_moved));
+
 		if (!wait && !did_work) {
 			u64 min_member_capacity = bch2_min_rw_member_capacity(c);
 
@@ -3,6 +3,7 @@
 #define _BCACHEFS_MOVINGGC_H
 
 unsigned long bch2_copygc_wait_amount(struct bch_fs *);
+u64 bch2_copygc_fragmented(struct bch_fs *);
 void bch2_copygc_wait_to_text(struct printbuf *, struct bch_fs *);
 
 void bch2_copygc_stop(struct bch_fs *);
@@ -90,6 +90,7 @@ void bch2_quota_to_text(struct printbuf *out, struct bch_fs *c,
 
 #include <linux/cred.h>
 #include <linux/fs.h>
+#include <linux/hash.h>
 #include <linux/quota.h>
 
 static void qc_info_to_text(struct printbuf *out, struct qc_info *i)
@@ -348,6 +349,106 @@ static int bch2_quota_check_limit(struct bch_fs *c,
 	return 0;
 }
 
+/* Per cpu deltas: */
+
+/* Largest delta, by counter, a cpu may hold without folding: */
+static const s64 memquota_pcpu_max[Q_COUNTERS] = {
+	[Q_SPC]	= 2048,		/* sectors */
+	[Q_INO]	= 64,
+};
+
+/* Fold every cpu's pending deltas into the quota table: */
+static void memquota_fold(struct bch_memquota_type *q)
+{
+	int cpu;
+
+	lockdep_assert_held(&q->lock);
+
+	for_each_possible_cpu(cpu) {
+		struct memquota_pcpu *p = per_cpu_ptr(q->pcpu, cpu);
+
+		spin_lock(&p->lock);
+		for (struct memquota_delta *d = p->d;
+		     d < p->d + ARRAY_SIZE(p->d);
+		     d++) {
+			if (!d->mq)
+				continue;
+
+			for (unsigned i = 0; i < Q_COUNTERS; i++)
+				d->mq->c[i].v += d->v[i];
+			memset(d, 0, sizeof(*d));
+		}
+		spin_unlock(&p->lock);
+	}
+}
+
+/*
+ * Whether an update can skip the limit checks: the limits are checked against
+ * the last folded value, with enough slack for whatever other cpus may have
+ * accounted and not yet folded:
+ */
+static bool memquota_fast_ok(struct memquota_counter *qc,
+			     enum quota_counters counter, s64 v,
+			     enum quota_acct_mode mode)
+{
+	if (mode == KEY_TYPE_QUOTA_NOCHECK)
+		return true;
+
+	if (v <= 0)
+		return !READ_ONCE(qc->warning_issued);
+
+	u64 limit = min_not_zero(READ_ONCE(qc->hardlimit),
+				 READ_ONCE(qc->softlimit));
+	if (!limit)
+		return true;
+
+	u64 slack = memquota_pcpu_max[counter] * num_online_cpus();
+
+	return READ_ONCE(qc->v) + v + slack < limit;
+}
+
+static bool bch2_quota_acct_fast(struct bch_fs *c, unsigned qtypes,
+				 struct bch_memquota **mq,
+				 enum quota_counters counter, s64 v,
+				 enum quota_acct_mode mode)
+{
+	struct bch_memquota_type *q;
+	struct memquota_pcpu *p[QTYP_NR];
+	struct memquota_delta *d[QTYP_NR];
+	unsigned cpu = raw_smp_processor_id();
+	unsigned i;
+	bool ret = true;
+
+	for_each_set_qtype(c, i, q, qtypes)
+		if (!memquota_fast_ok(&mq[i]->c[counter], counter, v, mode))
+			return false;
+
+	for_each_set_qtype(c, i, q, qtypes) {
+		p[i] = per_cpu_ptr(q->pcpu, cpu);
+		d[i] = &p[i]->d[hash_ptr(mq[i], MEMQUOTA_PCPU_SLOTS_BITS)];
+		spin_lock_nested(&p[i]->lock, i);
+	}
+
+	/*
+	 * All or nothing: if any slot is in use by another id or would go over
+	 * memquota_pcpu_max, the caller takes the slow path, which folds:
+	 */
+	for_each_set_qtype(c, i, q, qtypes)
+		ret &= (!d[i]->mq || d[i]->mq == mq[i]) &&
+			abs(d[i]->v[counter] + v) <= memquota_pcpu_max[counter];
+
+	if (ret)
+		for_each_set_qtype(c, i, q, qtypes) {
+			d[i]->mq = mq[i];
+			d[i]->v[counter] += v;
+		}
+
+	for_each_set_qtype(c, i, q, qtypes)
+		spin_unlock(&p[i]->lock);
+
+	return ret;
+}
+
 int bch2_quota_acct(struct bch_fs *c, struct bch_qid qid,
 		    enum quota_counters counter, s64 v,
 		    enum quota_acct_mode mode)
@@ -367,8 +468,13 @@ int bch2_quota_acct(struct bch_fs *c, struct bch_qid qid,
 			return -ENOMEM;
 	}
 
-	for_each_set_qtype(c, i, q, qtypes)
+	if (bch2_quota_acct_fast(c, qtypes, mq, counter, v, mode))
+		return 0;
+
+	for_each_set_qtype(c, i, q, qtypes) {
 		mutex_lock_nested(&q->lock, i);
+		memquota_fold(q);
+	}
 
 	for_each_set_qtype(c, i, q, qtypes) {
 		ret = bch2_quota_check_limit(c, i, mq[i], &msgs, counter, v, mode);
@@ -420,8 +526,10 @@ int bch2_quota_transfer(struct bch_fs *c, unsigned qtypes,
 			return -ENOMEM;
 	}
 
-	for_each_set_qtype(c, i, q, qtypes)
+	for_each_set_qtype(c, i, q, qtypes) {
 		mutex_lock_nested(&q->lock, i);
+		memquota_fold(q);
+	}
 
 	for_each_set_qtype(c, i, q, qtypes) {
 		ret = bch2_quota_check_limit(c, i, dst_q[i], &msgs, Q_SPC,
@@ -500,16 +608,31 @@ void bch2_fs_quota_exit(struct bch_fs *c)
 {
 	unsigned i;
 
-	for (i = 0; i < ARRAY_SIZE(c->quotas); i++)
+	for (i = 0; i < ARRAY_SIZE(c->quotas); i++) {
+		free_percpu(c->quotas[i].pcpu);
 		genradix_free(&c->quotas[i].table);
+	}
 }
 
-void bch2_fs_quota_init(struct bch_fs *c)
+int bch2_fs_quota_init(struct bch_fs *c)
 {
 	unsigned i;
+	int cpu;
 
-	for (i = 0; i < ARRAY_SIZE(c->quotas); i++)
-		mutex_init(&c->quotas[i].lock);
+	for (i = 0; i < ARRAY_SIZE(c->quotas); i++) {
+		struct bch_memquota_type *q = &c->quotas[i];
+
+		mutex_init(&q->lock);
+
+		q->pcpu = alloc_percpu(struct memquota_pcpu);
+		if (!q->pcpu)
+			return -BCH_ERR_ENOMEM_fs_quota_init;
+
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(q->pcpu, cpu)->lock);
+	}
+
+	return 0;
 }
 
 static struct bch_sb_field_quota *bch2_sb_get_or_create_quota(struct bch_sb_handle *sb)
@@ -860,6 +983,7 @@ static int bch2_get_quota(struct super_block *sb, struct kqid kqid,
 	memset(qdq, 0, sizeof(*qdq));
 
 	mutex_lock(&q->lock);
+	memquota_fold(q);
 	mq = genradix_ptr(&q->table, qid);
 	if (mq)
 		__bch2_quota_get(qdq, mq);
@@ -879,6 +1003,7 @@ static int bch2_get_next_quota(struct super_block *sb, struct kqid *kqid,
 	int ret = 0;
 
 	mutex_lock(&q->lock);
+	memquota_fold(q);
 
 	genradix_for_each_from(&q->table, iter, mq, qid)
 		if (memcmp(mq, page_address(ZERO_PAGE(0)), sizeof(*mq))) {
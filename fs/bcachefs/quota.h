@@ -43,7 +43,7 @@ int bch2_quota_transfer(struct bch_fs *, unsigned, struct bch_qid,
 			struct bch_qid, u64, enum quota_acct_mode);
 
 void bch2_fs_quota_exit(struct bch_fs *);
-void bch2_fs_quota_init(struct bch_fs *);
+int bch2_fs_quota_init(struct bch_fs *);
 int bch2_fs_quota_read(struct bch_fs *);
 
 extern const struct quotactl_ops bch2_quotactl_operations;
@@ -66,7 +66,7 @@ static inline int bch2_quota_transfer(struct bch_fs *c, unsigned qtypes,
 }
 
 static inline void bch2_fs_quota_exit(struct bch_fs *c) {}
-static inline void bch2_fs_quota_init(struct bch_fs *c) {}
+static inline int bch2_fs_quota_init(struct bch_fs *c) { return 0; }
 static inline int bch2_fs_quota_read(struct bch_fs *c) { return 0; }
 
 #endif
@@ -29,6 +29,24 @@ struct bch_memquota {
 
 typedef GENRADIX(struct bch_memquota)	bch_memquota_table;
 
+#define MEMQUOTA_PCPU_SLOTS_BITS	6
+
+struct memquota_delta {
+	struct bch_memquota		*mq;
+	s64				v[Q_COUNTERS];
+};
+
+/*
+ * Per cpu usage deltas that haven't been folded into the bch_memquota table
+ * yet, so that accounting against quotas that aren't near their limits doesn't
+ * have to take bch_memquota_type.lock; slots are indexed by a hash of the
+ * bch_memquota they apply to:
+ */
+struct memquota_pcpu {
+	spinlock_t			lock;
+	struct memquota_delta		d[1U << MEMQUOTA_PCPU_SLOTS_BITS];
+};
+
 struct quota_limit {
 	u32				timelimit;
 	u32				warnlimit;
@@ -38,6 +56,7 @@ struct bch_memquota_type {
 	struct quota_limit		limits[Q_COUNTERS];
 	bch_memquota_table		table;
 	struct mutex			lock;
+	struct memquota_pcpu __percpu	*pcpu;
 };
 
 #endif /* _BCACHEFS_QUOTA_TYPES_H */
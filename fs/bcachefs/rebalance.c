@@ -14,6 +14,7 @@
 #include "error.h"
 #include "inode.h"
 #include "move.h"
+#include "movinggc.h"
 #include "rebalance.h"
 #include "subvolume.h"
 #include "super-io.h"
@@ -52,6 +53,13 @@ static int __bch2_set_rebalance_needs_scan(struct btree_trans *trans, u64 inum)
 		? le64_to_cpu(bkey_s_c_to_cookie(k).v->cookie)
 		: 0;
 
+	/*
+	 * A pending whole filesystem scan we don't know the options for (e.g.
+	 * queued before we were mounted) has to stay a full scan:
+	 */
+	if (!inum && v && !atomic_long_read(&trans->c->rebalance.scan_opts))
+		atomic_long_set(&trans->c->rebalance.scan_opts, ~0UL);
+
 	cookie = bch2_trans_kmalloc(trans, sizeof(*cookie));
 	ret = PTR_ERR_OR_ZERO(cookie);
 	if (ret)
@@ -77,7 +85,37 @@ int bch2_set_rebalance_needs_scan(struct bch_fs *c, u64 inum)
 
 int bch2_set_fs_needs_rebalance(struct bch_fs *c)
 {
-	return bch2_set_rebalance_needs_scan(c, 0);
+	int ret = bch2_set_rebalance_needs_scan(c, 0);
+
+	atomic_long_or(~0UL, &c->rebalance.scan_opts);
+	return ret;
+}
+
+/*
+ * Filesystem option @id changed: queue a scan of the extents of the inodes that
+ * use the filesystem default for it:
+ */
+int bch2_set_fs_opt_needs_rebalance(struct bch_fs *c, enum bch_opt_id id)
+{
+	unsigned long opts;
+	int ret = bch2_set_rebalance_needs_scan(c, 0);
+
+	switch (id) {
+	case Opt_background_target:
+		opts = BIT(Inode_opt_background_target);
+		break;
+	case Opt_background_compression:
+		opts = BIT(Inode_opt_background_compression);
+		break;
+	case Opt_compression:
+		opts = BIT(Inode_opt_compression);
+		break;
+	default:
+		opts = ~0UL;
+	}
+
+	atomic_long_or(opts, &c->rebalance.scan_opts);
+	return ret;
 }
 
 static int bch2_clear_rebalance_needs_scan(struct btree_trans *trans, u64 inum, u64 cookie)
@@ -244,6 +282,24 @@ static int do_rebalance_extent(struct moving_context *ctxt,
 	return ret;
 }
 
+/*
+ * Progress accounting: move_stats are reset for every pass, so before they're
+ * reset what they counted is folded into the running total:
+ */
+static void rebalance_progress_fold(struct bch_fs_rebalance *r,
+				    struct bch_move_stats *stats)
+{
+	r->progress.sectors_base += atomic64_read(&stats->sectors_moved);
+}
+
+static void rebalance_progress_update(struct bch_fs_rebalance *r)
+{
+	bch2_move_progress_update(&r->progress,
+				  r->progress.sectors_base +
+				  atomic64_read(&r->work_stats.sectors_moved) +
+				  atomic64_read(&r->scan_stats.sectors_moved));
+}
+
 static bool rebalance_pred(struct bch_fs *c, void *arg,
 			   struct bkey_s_c k,
 			   struct bch_io_opts *io_opts,
@@ -266,18 +322,353 @@ static bool rebalance_pred(struct bch_fs *c, void *arg,
 	return data_opts->rewrite_ptrs != 0;
 }
 
+static bool rebalance_writeback_enabled(struct bch_fs *c)
+{
+	return READ_ONCE(c->rebalance.writeback_watermark) &&
+		c->opts.foreground_target &&
+		c->opts.background_target;
+}
+
+/* Whole filesystem scans: */
+
+#define REBALANCE_SCAN_OPTS					\
+	(BIT(Inode_opt_background_target)|			\
+	 BIT(Inode_opt_background_compression)|			\
+	 BIT(Inode_opt_compression))
+
+typedef DARRAY(struct bpos) rebalance_scan_bounds;
+
+/*
+ * After a filesystem option changed, the extents of inodes that set the option
+ * themselves (or inherited it from their parent directory) don't need to be
+ * looked at; @opts is the set of options that changed, as Inode_opt_* bits:
+ */
+static bool rebalance_scan_inode_affected(struct bch_inode_unpacked *inode,
+					  unsigned long opts)
+{
+	if ((opts & BIT(Inode_opt_background_target)) &&
+	    !inode->bi_background_target)
+		return true;
+
+	if ((opts & BIT(Inode_opt_background_compression)) &&
+	    !inode->bi_background_compression)
+		return true;
+
+	/* compression is only used when background_compression isn't set: */
+	return (opts & BIT(Inode_opt_compression)) &&
+		!inode->bi_background_compression &&
+		!inode->bi_compression;
+}
+
+static bool rebalance_scan_range_pred(struct bch_fs *c, void *arg,
+				      struct bkey_s_c k,
+				      struct bch_io_opts *io_opts,
+				      struct data_update_opts *data_opts)
+{
+	struct rebalance_scan_range *range = arg;
+
+	/* Extents straddling the start of the range belong to the previous range: */
+	if (bpos_lt(bkey_start_pos(k.k), range->start.pos))
+		return false;
+
+	return rebalance_pred(c, NULL, k, io_opts, data_opts);
+}
+
+/*
+ * One scan worker per device in the background target, so that moves to
+ * different devices proceed in parallel:
+ */
+static unsigned rebalance_scan_nr_workers(struct bch_fs *c)
+{
+	unsigned target = c->opts.background_target, nr = 0;
+
+	for_each_rw_member(c, ca)
+		nr += !target || bch2_dev_in_target(c, ca->dev_idx, target);
+
+	return clamp(nr, 1U, REBALANCE_SCAN_WORKERS_MAX);
+}
+
+/*
+ * Pick up to @nr - 1 positions that split @btree into ranges of roughly the
+ * same number of leaf nodes, using the boundaries of the nodes one level up:
+ */
+static int rebalance_scan_bounds_get(struct btree_trans *trans, enum btree_id btree,
+				     unsigned nr, rebalance_scan_bounds *bounds)
+{
+	struct btree_iter iter;
+	struct btree *b;
+	rebalance_scan_bounds nodes = {};
+	int ret = 0;
+
+	__for_each_btree_node(trans, iter, btree, POS_MIN, 0, 1, 0, b, ret) {
+		if (bpos_eq(b->key.k.p, SPOS_MAX))
+			break;
+
+		ret = darray_push(&nodes, b->key.k.p);
+		if (ret)
+			break;
+	}
+	bch2_trans_iter_exit(trans, &iter);
+	if (ret)
+		goto err;
+
+	for (unsigned i = 1; i < nr && nodes.nr; i++) {
+		struct bpos pos = bpos_successor(nodes.data[(u64) nodes.nr * i / nr]);
+
+		if (bounds->nr && bpos_le(pos, darray_last(*bounds)))
+			continue;
+
+		ret = darray_push(bounds, pos);
+		if (ret)
+			break;
+	}
+err:
+	darray_exit(&nodes);
+	return ret;
+}
+
+/* Add [@start, @end) of @btree to the ranges to scan, split at @bounds: */
+static int rebalance_scan_add_range(struct bch_fs_rebalance *r, enum btree_id btree,
+				    struct bpos start, struct bpos end,
+				    rebalance_scan_bounds *bounds)
+{
+	int ret;
+
+	darray_for_each(*bounds, i) {
+		if (bpos_le(*i, start))
+			continue;
+		if (bpos_ge(*i, end))
+			break;
+
+		ret = darray_push(&r->scan_ranges, ((struct rebalance_scan_range) {
+			BBPOS(btree, start), BBPOS(btree, *i) }));
+		if (ret)
+			return ret;
+		start = *i;
+	}
+
+	return darray_push(&r->scan_ranges, ((struct rebalance_scan_range) {
+		BBPOS(btree, start), BBPOS(btree, end) }));
+}
+
+/*
+ * Add the parts of the extents btree belonging to runs of inodes affected by
+ * the options in @opts; inodes without data don't break up a run. This walks
+ * the inodes btree instead of every extent:
+ */
+static int rebalance_scan_add_inodes(struct btree_trans *trans, unsigned long opts,
+				     rebalance_scan_bounds *bounds)
+{
+	struct bch_fs_rebalance *r = &trans->c->rebalance;
+	u64 run_start = 0, run_end = 0;
+
+	int ret = for_each_btree_key(trans, iter, BTREE_ID_inodes, POS_MIN,
+				     BTREE_ITER_PREFETCH|BTREE_ITER_ALL_SNAPSHOTS, k, ({
+		struct bch_inode_unpacked inode;
+		u64 inum = k.k->p.offset;
+		int ret2 = 0;
+
+		if (!bkey_is_inode(k.k) ||
+		    bch2_inode_unpack(k, &inode) ||
+		    !inode.bi_sectors)
+			;
+		else if (rebalance_scan_inode_affected(&inode, opts)) {
+			if (!run_end)
+				run_start = inum;
+			run_end = inum + 1;
+		} else if (run_end && run_end != inum + 1) {
+			/* another snapshot version of an affected inode doesn't end the run */
+			ret2 = rebalance_scan_add_range(r, BTREE_ID_extents,
+							POS(run_start, 0), POS(run_end, 0),
+							bounds);
+			run_end = 0;
+		}
+		ret2;
+	}));
+
+	if (!ret && run_end)
+		ret = rebalance_scan_add_range(r, BTREE_ID_extents,
+					       POS(run_start, 0), POS(run_end, 0),
+					       bounds);
+	return ret;
+}
+
+/*
+ * Build the list of ranges to scan, split so that @nr workers can share them;
+ * if we don't know which options changed (@opts is 0), everything is scanned:
+ */
+static int rebalance_scan_ranges_get(struct btree_trans *trans, unsigned long opts,
+				     unsigned nr)
+{
+	struct bch_fs *c = trans->c;
+	struct bch_fs_rebalance *r = &c->rebalance;
+	int ret = 0;
+
+	if (opts & ~REBALANCE_SCAN_OPTS)
+		opts = 0;
+
+	for (enum btree_id id = 0; id < btree_id_nr_alive(c) && !ret; id++) {
+		if (!btree_type_has_ptrs(id) ||
+		    !bch2_btree_id_root(c, id)->b)
+			continue;
+
+		rebalance_scan_bounds bounds = {};
+
+		/*
+		 * Indirect extents use the filesystem options unless they carry
+		 * their own, so the reflink btree is always scanned in full:
+		 */
+		ret = rebalance_scan_bounds_get(trans, id, nr * 4, &bounds) ?:
+			(id == BTREE_ID_extents && opts
+			 ? rebalance_scan_add_inodes(trans, opts, &bounds)
+			 : rebalance_scan_add_range(r, id, POS_MIN, SPOS_MAX, &bounds));
+		darray_exit(&bounds);
+	}
+
+	return ret;
+}
+
+static int bch2_rebalance_scan_thread(void *arg)
+{
+	struct bch_fs *c = arg;
+	struct bch_fs_rebalance *r = &c->rebalance;
+	struct moving_context ctxt;
+	int ret = 0;
+
+	set_freezable();
+
+	bch2_moving_ctxt_init(&ctxt, c, NULL, &r->scan_stats,
+			      writepoint_hashed((unsigned long) current),
+			      true);
+
+	while (!ret && !kthread_should_stop()) {
+		unsigned i = atomic_inc_return(&r->scan_next) - 1;
+		if (i >= r->scan_ranges.nr)
+			break;
+
+		/* rebalance was disabled: the scan will be redone when it's re-enabled */
+		if (!r->enabled) {
+			ret = 1;
+			break;
+		}
+
+		struct rebalance_scan_range *range = &r->scan_ranges.data[i];
+
+		/* All workers share the writeback flush rate: */
+		ctxt.rate = rebalance_writeback_enabled(c) ? &r->pd.rate : NULL;
+
+		ret = __bch2_move_data(&ctxt, range->start, range->end,
+				       rebalance_scan_range_pred, range);
+	}
+
+	bch2_moving_ctxt_exit(&ctxt);
+
+	if (ret)
+		cmpxchg(&r->scan_ret, 0, ret);
+	if (atomic_dec_and_test(&r->scan_running))
+		wake_up(&r->scan_wait);
+
+	/* The rebalance thread stops us, when all workers are done: */
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		schedule();
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/*
+ * Scan the parts of the filesystem affected by the options in @opts, with one
+ * worker per device in the background target; returns 1 if we were interrupted
+ * before finishing:
+ */
+static int do_rebalance_scan_fs(struct moving_context *ctxt, unsigned long opts,
+				unsigned nr)
+{
+	struct btree_trans *trans = ctxt->trans;
+	struct bch_fs *c = trans->c;
+	struct bch_fs_rebalance *r = &c->rebalance;
+	unsigned i, started = 0;
+	int ret = 0;
+
+	ret = rebalance_scan_ranges_get(trans, opts, nr);
+	if (ret)
+		goto err;
+
+	bch2_trans_unlock_long(trans);
+
+	atomic_set(&r->scan_next, 0);
+	atomic_set(&r->scan_running, nr);
+	r->scan_ret = 0;
+
+	for (i = 0; i < nr && nr > 1; i++) {
+		struct task_struct *p = kthread_create(bch2_rebalance_scan_thread, c,
+						"bch-rebalance-scan/%s", c->name);
+		if (IS_ERR(p)) {
+			atomic_dec(&r->scan_running);
+			continue;
+		}
+
+		get_task_struct(p);
+		r->scan_workers[started++] = p;
+		wake_up_process(p);
+	}
+
+	if (!started) {
+		/* Single worker, or couldn't start any: do it ourselves */
+		for (i = 0; i < r->scan_ranges.nr && !ret; i++) {
+			if (!r->enabled || kthread_should_stop()) {
+				ret = 1;
+				break;
+			}
+
+			ret = __bch2_move_data(ctxt,
+					r->scan_ranges.data[i].start,
+					r->scan_ranges.data[i].end,
+					rebalance_scan_range_pred,
+					&r->scan_ranges.data[i]);
+		}
+		goto err;
+	}
+
+	wait_event_freezable(r->scan_wait,
+			     !atomic_read(&r->scan_running) ||
+			     !r->enabled ||
+			     kthread_should_stop());
+
+	if (atomic_read(&r->scan_running))
+		ret = 1;
+
+	for (i = 0; i < started; i++) {
+		kthread_stop(r->scan_workers[i]);
+		put_task_struct(r->scan_workers[i]);
+		r->scan_workers[i] = NULL;
+	}
+
+	if (!ret)
+		ret = r->scan_ret;
+err:
+	darray_exit(&r->scan_ranges);
+	return ret;
+}
+
 static int do_rebalance_scan(struct moving_context *ctxt, u64 inum, u64 cookie)
 {
 	struct btree_trans *trans = ctxt->trans;
 	struct bch_fs_rebalance *r = &trans->c->rebalance;
+	unsigned long opts = 0;
 	int ret;
 
+	rebalance_progress_fold(r, &r->scan_stats);
 	bch2_move_stats_init(&r->scan_stats, "rebalance_scan");
 	ctxt->stats = &r->scan_stats;
 
 	if (!inum) {
 		r->scan_start	= BBPOS_MIN;
 		r->scan_end	= BBPOS_MAX;
+		opts		= atomic_long_xchg(&r->scan_opts, 0);
 	} else {
 		r->scan_start	= BBPOS(BTREE_ID_extents, POS(inum, 0));
 		r->scan_end	= BBPOS(BTREE_ID_extents, POS(inum, U64_MAX));
@@ -285,14 +676,105 @@ static int do_rebalance_scan(struct moving_context *ctxt, u64 inum, u64 cookie)
 
 	r->state = BCH_REBALANCE_scanning;
 
-	ret = __bch2_move_data(ctxt, r->scan_start, r->scan_end, rebalance_pred, NULL) ?:
-		commit_do(trans, NULL, NULL, BCH_TRANS_COMMIT_no_enospc,
-			  bch2_clear_rebalance_needs_scan(trans, inum, cookie));
+	ret = !inum
+		? do_rebalance_scan_fs(ctxt, opts, rebalance_scan_nr_workers(trans->c))
+		: __bch2_move_data(ctxt, r->scan_start, r->scan_end, rebalance_pred, NULL);
+	if (ret > 0) {
+		/* interrupted; the scan entry stays, we'll redo it later */
+		if (!inum)
+			atomic_long_or(opts ?: ~0UL, &r->scan_opts);
+		ret = 0;
+		goto out;
+	}
+
+	ret = ret ?: commit_do(trans, NULL, NULL, BCH_TRANS_COMMIT_no_enospc,
+			       bch2_clear_rebalance_needs_scan(trans, inum, cookie));
+out:
 
 	bch2_move_stats_exit(&r->scan_stats, trans->c);
 	return ret;
 }
 
+/* Writeback mode: */
+
+/* Sectors of user data on, and total capacity of, the foreground target: */
+static void rebalance_writeback_usage(struct bch_fs *c, u64 *dirty, u64 *capacity)
+{
+	unsigned target = c->opts.foreground_target;
+
+	*dirty = *capacity = 0;
+
+	for_each_rw_member(c, ca) {
+		if (!bch2_dev_in_target(c, ca->dev_idx, target))
+			continue;
+
+		struct bch_dev_usage u = bch2_dev_usage_read(ca);
+
+		*dirty		+= u.d[BCH_DATA_user].sectors;
+		*capacity	+= bucket_to_sector(ca, ca->mi.nbuckets - ca->mi.first_bucket);
+	}
+}
+
+/*
+ * Update how full the foreground target is, and the flush rate: the PD
+ * controller drives the amount of data on the foreground target towards the
+ * watermark, so below it data stays on the fast tier and is flushed slowly,
+ * and above it the flush rate ramps up smoothly instead of everything being
+ * flushed in a burst.
+ *
+ * Reading device usage isn't free, so this is done at most once a second; the
+ * first caller after that does the update.
+ */
+static void rebalance_writeback_update(struct bch_fs *c)
+{
+	struct bch_fs_rebalance *r = &c->rebalance;
+	unsigned long updated = READ_ONCE(r->writeback_fullness_updated);
+	u64 dirty, capacity;
+
+	if (!rebalance_writeback_enabled(c)) {
+		WRITE_ONCE(r->writeback_fullness, 0);
+		return;
+	}
+
+	if (!time_after(jiffies, updated + HZ) ||
+	    cmpxchg(&r->writeback_fullness_updated, updated, jiffies) != updated)
+		return;
+
+	rebalance_writeback_usage(c, &dirty, &capacity);
+	if (!capacity)
+		return;
+
+	WRITE_ONCE(r->writeback_fullness, div64_u64(dirty * 100, capacity));
+
+	bch2_pd_controller_update(&r->pd,
+			div_u64(capacity * READ_ONCE(r->writeback_watermark), 100),
+			dirty, -1);
+}
+
+/*
+ * Called before foreground writes: throttle writers only when the fast tier is
+ * nearly full of data that hasn't been flushed yet, by an amount that grows
+ * the closer it is to full.
+ */
+void bch2_rebalance_writeback_throttle(struct bch_fs *c)
+{
+	struct bch_fs_rebalance *r = &c->rebalance;
+	unsigned throttle = READ_ONCE(r->writeback_throttle);
+
+	if (!rebalance_writeback_enabled(c) || !throttle)
+		return;
+
+	rebalance_writeback_update(c);
+
+	unsigned fullness = min(READ_ONCE(r->writeback_fullness), 100U);
+	if (fullness < throttle)
+		return;
+
+	rebalance_wakeup(c);
+	schedule_timeout_killable(max_t(unsigned long, 1,
+			(HZ / 10) * (fullness - throttle) / max(1U, 100 - throttle)));
+}
+
 static void rebalance_wait(struct bch_fs *c)
 {
 	struct bch_fs_rebalance *r = &c->rebalance;
@@ -323,6 +805,8 @@ static int do_rebalance(struct moving_context *ctxt)
 	struct bkey_s_c k;
 	int ret = 0;
 
+	rebalance_progress_fold(r, &r->work_stats);
+	rebalance_progress_fold(r, &r->scan_stats);
 	bch2_move_stats_init(&r->work_stats, "rebalance_work");
 	bch2_move_stats_init(&r->scan_stats, "rebalance_scan");
 
@@ -330,7 +814,19 @@ static int do_rebalance(struct moving_context *ctxt)
 			     BTREE_ID_rebalance_work, POS_MIN,
 			     BTREE_ITER_ALL_SNAPSHOTS);
 
-	while (!bch2_move_ratelimit(ctxt)) {
+	while (1) {
+		if (rebalance_writeback_enabled(c)) {
+			rebalance_writeback_update(c);
+			ctxt->rate = &r->pd.rate;
+		} else {
+			ctxt->rate = NULL;
+		}
+
+		rebalance_progress_update(r);
+
+		if (bch2_move_ratelimit(ctxt))
+			break;
+
 		if (!r->enabled) {
 			bch2_moving_ctxt_flush_all(ctxt);
 			kthread_wait_freezable(r->enabled ||
@@ -432,9 +928,187 @@ void bch2_rebalance_status_to_text(struct printbuf *out, struct bch_fs *c)
 		break;
 	}
 	prt_newline(out);
+
+	if (rebalance_writeback_enabled(c)) {
+		prt_printf(out, "writeback: foreground target %u%% full, watermark %u%%, throttle at %u%%\n",
+			   r->writeback_fullness, r->writeback_watermark, r->writeback_throttle);
+		prt_str(out, "flush rate: ");
+		prt_human_readable_u64(out, (u64) r->pd.rate.rate << 9);
+		prt_str(out, "/sec\n");
+	}
+
 	printbuf_indent_sub(out, 2);
 }
 
+/* Progress/ETA reporting: */
+
+#define BACKGROUND_PROGRESS_WALK_MAX	(1U << 14)
+
+static void background_progress_add(struct bch_background_progress *p,
+				    unsigned target, u64 sectors)
+{
+	darray_for_each(p->targets, i)
+		if (i->target == target) {
+			i->sectors_pending += sectors;
+			return;
+		}
+
+	/* if we can't allocate, the total is still correct: */
+	darray_push(&p->targets, ((struct bch_ioctl_background_progress_target) {
+		.target			= target,
+		.sectors_pending	= sectors,
+	}));
+}
+
+static int background_progress_extent(struct btree_trans *trans, struct bpos work_pos,
+				      struct bch_background_progress *p)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k = bch2_bkey_get_iter(trans, &iter,
+				work_pos.inode ? BTREE_ID_extents : BTREE_ID_reflink,
+				work_pos,
+				BTREE_ITER_ALL_SNAPSHOTS);
+	int ret = bkey_err(k);
+	if (ret)
+		return ret;
+
+	const struct bch_extent_rebalance *r = bch2_bkey_rebalance_opts(k);
+	if (r) {
+		p->rebalance.sectors_pending += k.k->size;
+		background_progress_add(p, r->target, k.k->size);
+	}
+
+	bch2_trans_iter_exit(trans, &iter);
+	return 0;
+}
+
+/*
+ * Walks the rebalance_work btree (restricted to @p->inum if nonzero) to total
+ * up pending rebalance work, and fills in copygc's pending work; ETAs are based
+ * on each job's recent throughput.
+ *
+ * This is polled, so it's kept cheap: the btree write buffer isn't flushed, so
+ * work queued in the last few moments may not be counted yet, and at most
+ * BACKGROUND_PROGRESS_WALK_MAX entries are looked at - if there are more,
+ * BCH_BACKGROUND_PROGRESS_PARTIAL is set and the rebalance totals are lower
+ * bounds.
+ *
+ * Caller must darray_exit(&p->targets).
+ */
+int bch2_background_progress(struct bch_fs *c, struct bch_background_progress *p)
+{
+	struct bch_fs_rebalance *r = &c->rebalance;
+	struct bpos start	= p->inum ? POS(p->inum, 0) : POS_MIN;
+	struct bpos end		= p->inum ? POS(p->inum, U64_MAX) : SPOS_MAX;
+	unsigned nr = 0;
+
+	p->flags = 0;
+	p->scans_pending = 0;
+	memset(&p->rebalance, 0, sizeof(p->rebalance));
+	memset(&p->copygc, 0, sizeof(p->copygc));
+	darray_init(&p->targets);
+
+	int ret = bch2_trans_run(c,
+		for_each_btree_key_upto(trans, iter, BTREE_ID_rebalance_work,
+					start, end, BTREE_ITER_ALL_SNAPSHOTS, k, ({
+			int ret2 = 0;
+
+			if (nr >= BACKGROUND_PROGRESS_WALK_MAX) {
+				p->flags |= BCH_BACKGROUND_PROGRESS_PARTIAL;
+				break;
+			}
+
+			if (k.k->type == KEY_TYPE_cookie)
+				p->scans_pending++;
+			else
+				ret2 = background_progress_extent(trans, k.k->p, p);
+			nr += !ret2;
+			ret2;
+		})));
+	if (ret)
+		return ret;
+
+	p->rebalance.sectors_done	= r->progress.sectors_done;
+	p->rebalance.rate		= r->progress.rate;
+	p->rebalance.eta		= bch2_move_progress_eta(&r->progress,
+							p->rebalance.sectors_pending);
+
+	p->copygc.sectors_pending	= bch2_copygc_fragmented(c);
+	p->copygc.sectors_done		= c->copygc_progress.sectors_done;
+	p->copygc.rate			= c->copygc_progress.rate;
+	p->copygc.eta			= bch2_move_progress_eta(&c->copygc_progress,
+							p->copygc.sectors_pending);
+	return 0;
+}
+
+/* @partial: pending work wasn't all counted, so pending and eta are lower bounds */
+static void background_progress_job_to_text(struct printbuf *out, const char *name,
+					    struct bch_ioctl_background_progress_job *j,
+					    bool partial)
+{
+	prt_printf(out, "%s:\n", name);
+	printbuf_indent_add(out, 2);
+
+	prt_str(out, "pending:\t");
+	if (partial)
+		prt_str(out, "at least ");
+	prt_human_readable_u64(out, j->sectors_pending << 9);
+	prt_newline(out);
+
+	prt_str(out, "done:\t");
+	prt_human_readable_u64(out, j->sectors_done << 9);
+	prt_newline(out);
+
+	prt_str(out, "rate:\t");
+	prt_human_readable_u64(out, j->rate << 9);
+	prt_str(out, "/sec\n");
+
+	prt_str(out, "eta:\t");
+	if (j->eta == U64_MAX) {
+		prt_str(out, "unknown");
+	} else {
+		if (partial)
+			prt_str(out, "at least ");
+		bch2_pr_time_units(out, j->eta * NSEC_PER_SEC);
+	}
+	prt_newline(out);
+
+	printbuf_indent_sub(out, 2);
+}
+
+void bch2_background_progress_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	struct bch_background_progress p = {};
+	int ret = bch2_background_progress(c, &p);
+	if (ret) {
+		prt_printf(out, "error: %s\n", bch2_err_str(ret));
+		goto out;
+	}
+
+	printbuf_tabstop_push(out, 24);
+
+	background_progress_job_to_text(out, "rebalance", &p.rebalance,
+					p.flags & BCH_BACKGROUND_PROGRESS_PARTIAL);
+
+	printbuf_indent_add(out, 2);
+	prt_printf(out, "scans pending:\t%llu\n", p.scans_pending);
+	darray_for_each(p.targets, i) {
+		prt_str(out, "target ");
+		if (i->target)
+			bch2_target_to_text(out, c, i->target);
+		else
+			prt_str(out, "(none)");
+		prt_str(out, ":\t");
+		prt_human_readable_u64(out, i->sectors_pending << 9);
+		prt_newline(out);
+	}
+	printbuf_indent_sub(out, 2);
+
+	background_progress_job_to_text(out, "copygc", &p.copygc, false);
+out:
+	darray_exit(&p.targets);
+}
+
 void bch2_rebalance_stop(struct bch_fs *c)
 {
 	struct task_struct *p;
@@ -480,4 +1154,7 @@ int bch2_rebalance_start(struct bch_fs *c)
 void bch2_fs_rebalance_init(struct bch_fs *c)
 {
 	bch2_pd_controller_init(&c->rebalance.pd);
+	init_waitqueue_head(&c->rebalance.scan_wait);
+	c->rebalance.writeback_throttle = 95;
+	c->rebalance.writeback_fullness_updated = jiffies - HZ - 1;
 }
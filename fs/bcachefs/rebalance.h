@@ -2,10 +2,12 @@
 #ifndef _BCACHEFS_REBALANCE_H
 #define _BCACHEFS_REBALANCE_H
 
+#include "bcachefs_ioctl.h"
 #include "rebalance_types.h"
 
 int bch2_set_rebalance_needs_scan(struct bch_fs *, u64 inum);
 int bch2_set_fs_needs_rebalance(struct bch_fs *);
+int bch2_set_fs_opt_needs_rebalance(struct bch_fs *, enum bch_opt_id);
 
 static inline void rebalance_wakeup(struct bch_fs *c)
 {
@@ -18,8 +20,22 @@ static inline void rebalance_wakeup(struct bch_fs *c)
 	rcu_read_unlock();
 }
 
+void bch2_rebalance_writeback_throttle(struct bch_fs *);
+
 void bch2_rebalance_status_to_text(struct printbuf *, struct bch_fs *);
 
+struct bch_background_progress {
+	u32					flags;
+	u64					inum;
+	u64					scans_pending;
+	struct bch_ioctl_background_progress_job rebalance;
+	struct bch_ioctl_background_progress_job copygc;
+	DARRAY(struct bch_ioctl_background_progress_target) targets;
+};
+
+int bch2_background_progress(struct bch_fs *, struct bch_background_progress *);
+void bch2_background_progress_to_text(struct printbuf *, struct bch_fs *);
+
 void bch2_rebalance_stop(struct bch_fs *);
 int bch2_rebalance_start(struct bch_fs *);
 void bch2_fs_rebalance_init(struct bch_fs *);
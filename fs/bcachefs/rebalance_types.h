@@ -16,6 +16,13 @@ enum bch_rebalance_states {
 #undef x
 };
 
+#define REBALANCE_SCAN_WORKERS_MAX	8
+
+struct rebalance_scan_range {
+	struct bbpos			start;
+	struct bbpos			end;
+};
+
 struct bch_fs_rebalance {
 	struct task_struct __rcu	*thread;
 	struct bch_pd_controller pd;
@@ -31,7 +38,37 @@ struct bch_fs_rebalance {
 	struct bbpos			scan_end;
 	struct bch_move_stats		scan_stats;
 
+	/*
+	 * Filesystem options (Inode_opt_* bits) changed since the last whole
+	 * filesystem scan started; 0 if unknown, meaning everything is scanned:
+	 */
+	atomic_long_t			scan_opts;
+
+	/*
+	 * Whole filesystem scans walk only the ranges affected by scan_opts,
+	 * split up and done in parallel:
+	 */
+	DARRAY(struct rebalance_scan_range) scan_ranges;
+	atomic_t			scan_next;
+	atomic_t			scan_running;
+	int				scan_ret;
+	wait_queue_head_t		scan_wait;
+	struct task_struct		*scan_workers[REBALANCE_SCAN_WORKERS_MAX];
+
+	struct bch_move_progress	progress;
+
 	unsigned			enabled:1;
+
+	/*
+	 * Writeback mode: percentage of the foreground target that may hold
+	 * data waiting to be moved to the background target before the flush
+	 * rate is driven up (0 = off), and the fullness at which foreground
+	 * writes start being throttled:
+	 */
+	unsigned			writeback_watermark;
+	unsigned			writeback_throttle;
+	unsigned			writeback_fullness;
+	unsigned long			writeback_fullness_updated;
 };
 
 #endif /* _BCACHEFS_REBALANCE_TYPES_H */
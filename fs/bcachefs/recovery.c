@@ -11,6 +11,7 @@
 #include "btree_io.h"
 #include "buckets.h"
 #include "dirent.h"
+#include "dirent_cache.h"
 #include "ec.h"
 #include "errcode.h"
 #include "error.h"
@@ -682,6 +683,8 @@ static int bch2_run_recovery_pass(struct bch_fs *c, enum bch_recovery_pass pass)
 		bch2_print(c, KERN_INFO bch2_log_msg(c, "%s..."),
 			   bch2_recovery_passes[pass]);
 	ret = p->fn(c);
+	/* fsck passes may have added, removed or rewritten dirents: */
+	bch2_dirent_cache_invalidate_all(c);
 	if (ret)
 		return ret;
 	if (!(p->when & PASS_SILENT))
@@ -200,6 +200,55 @@ static s64 gc_trigger_reflink_p_segment(struct btree_trans *trans,
 	return ret;
 }
 
+static noinline int reflink_drop_seq_init(struct btree_trans *trans)
+{
+	struct bch_fs *c = trans->c;
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	int ret;
+
+	bch2_trans_iter_init(trans, &iter, BTREE_ID_reflink_drops, POS_MAX, 0);
+	k = bch2_btree_iter_peek_prev(&iter);
+	ret = bkey_err(k);
+	if (!ret)
+		atomic64_cmpxchg(&c->reflink_drop_seq, 0,
+				 k.k ? k.k->p.offset : 1);
+	bch2_trans_iter_exit(trans, &iter);
+	return ret;
+}
+
+/*
+ * Removing a reflink pointer: instead of updating every indirect extent in
+ * [start, end) - which, for an extent shared by many clones, means rewriting
+ * the whole key and contending on its btree node for every clone deleted -
+ * just log the dropped reference in the write buffer. When the write buffer is
+ * flushed, bch2_do_reflink_drops() applies them, coalescing drops to the same
+ * indirect extent into a single update.
+ *
+ * References are still taken synchronously, so an indirect extent's refcount
+ * is never lower than the real number of references to it and it's only
+ * deleted once nothing points to it.
+ */
+static int bch2_reflink_drop_defer(struct btree_trans *trans, u64 start, u64 end)
+{
+	struct bch_fs *c = trans->c;
+	struct bkey_i_reflink_drop d;
+	int ret;
+
+	if (unlikely(!atomic64_read(&c->reflink_drop_seq))) {
+		ret = reflink_drop_seq_init(trans);
+		if (ret)
+			return ret;
+	}
+
+	bkey_reflink_drop_init(&d.k_i);
+	d.k.p		= POS(0, atomic64_inc_return(&c->reflink_drop_seq));
+	d.v.start	= cpu_to_le64(start);
+	d.v.end		= cpu_to_le64(end);
+
+	return bch2_trans_update_buffered(trans, BTREE_ID_reflink_drops, &d.k_i);
+}
+
 static int __trigger_reflink_p(struct btree_trans *trans,
 			    enum btree_id btree_id, unsigned level,
 			    struct bkey_s_c k, unsigned flags)
@@ -212,21 +261,16 @@ static int __trigger_reflink_p(struct btree_trans *trans,
 	u64 end = le64_to_cpu(p.v->idx) + p.k->size + le32_to_cpu(p.v->back_pad);
 
 	if (flags & BTREE_TRIGGER_TRANSACTIONAL) {
+		if ((flags & BTREE_TRIGGER_OVERWRITE) &&
+		    bch2_reflink_drops_deferred(c))
+			return bch2_reflink_drop_defer(trans, idx, end);
+
 		while (idx < end && !ret)
 			ret = trans_trigger_reflink_p_segment(trans, p, &idx, flags);
 	}
 
 	if (flags & BTREE_TRIGGER_GC) {
-		size_t l = 0, r = c->reflink_gc_nr;
-
-		while (l < r) {
-			size_t m = l + (r - l) / 2;
-			struct reflink_gc *ref = genradix_ptr(&c->reflink_gc_table, m);
-			if (ref->offset <= idx)
-				l = m + 1;
-			else
-				r = m;
-		}
+		size_t l = bch2_reflink_gc_idx(c, idx);
 
 		while (idx < end && !ret)
 			ret = gc_trigger_reflink_p_segment(trans, p, &idx, flags, l++);
@@ -334,6 +378,173 @@ int bch2_trigger_indirect_inline_data(struct btree_trans *trans,
 	return 0;
 }
 
+/* deferred reference drops */
+
+#define REFLINK_DROPS_BATCH		32
+#define REFLINK_DROPS_MAX_UPDATES	128
+
+int bch2_reflink_drop_invalid(struct bch_fs *c, struct bkey_s_c k,
+			      enum bkey_invalid_flags flags,
+			      struct printbuf *err)
+{
+	struct bkey_s_c_reflink_drop d = bkey_s_c_to_reflink_drop(k);
+	int ret = 0;
+
+	bkey_fsck_err_on(le64_to_cpu(d.v->start) >= le64_to_cpu(d.v->end),
+			 c, err, reflink_drop_bad_range,
+			 "start >= end (%llu >= %llu)",
+			 le64_to_cpu(d.v->start), le64_to_cpu(d.v->end));
+fsck_err:
+	return ret;
+}
+
+void bch2_reflink_drop_to_text(struct printbuf *out, struct bch_fs *c,
+			       struct bkey_s_c k)
+{
+	struct bkey_s_c_reflink_drop d = bkey_s_c_to_reflink_drop(k);
+
+	prt_printf(out, "%llu-%llu",
+		   le64_to_cpu(d.v->start),
+		   le64_to_cpu(d.v->end));
+}
+
+static int reflink_drop_apply(struct btree_trans *trans,
+			      struct bkey_s_c_reflink_drop d)
+{
+	struct bch_fs *c = trans->c;
+	struct btree_iter iter;
+	struct bkey_i *k;
+	__le64 *refcount;
+	u64 idx = le64_to_cpu(d.v->start);
+	u64 end = le64_to_cpu(d.v->end);
+	struct printbuf buf = PRINTBUF;
+	int ret = 0;
+
+	while (idx < end && !ret) {
+		k = bch2_bkey_get_mut_noupdate(trans, &iter,
+				BTREE_ID_reflink, POS(0, idx),
+				BTREE_ITER_WITH_UPDATES);
+		ret = PTR_ERR_OR_ZERO(k);
+		if (ret)
+			goto next;
+
+		refcount = bkey_refcount(bkey_i_to_s(k));
+		if (!refcount || !*refcount) {
+			/*
+			 * Just report it: gc recomputes refcounts, and failing
+			 * here would leave the drop to be retried forever
+			 */
+			printbuf_reset(&buf);
+			bch2_bkey_val_to_text(&buf, c, d.s_c);
+			bch2_trans_inconsistent(trans,
+				"%s indirect extent at %llu while dropping reference\n  %s",
+				refcount ? "refcount underflow on" : "nonexistent",
+				idx, buf.buf);
+		} else {
+			le64_add_cpu(refcount, -1);
+
+			bch2_btree_iter_set_pos_to_extent_start(&iter);
+			ret = bch2_trans_update(trans, &iter, k, 0);
+			if (ret)
+				goto next;
+		}
+
+		idx = k->k.p.offset;
+next:
+		bch2_trans_iter_exit(trans, &iter);
+	}
+
+	printbuf_exit(&buf);
+	return ret;
+}
+
+/*
+ * Apply pending reference drops in batches, in a single transaction per batch,
+ * so that drops to the same indirect extent are coalesced into one update:
+ */
+static int bch2_reflink_drops_apply(struct btree_trans *trans, u64 *nr_applied)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	int ret = 0;
+
+	*nr_applied = 0;
+
+	bch2_trans_iter_init(trans, &iter, BTREE_ID_reflink_drops, POS_MIN,
+			     BTREE_ITER_INTENT|BTREE_ITER_PREFETCH);
+
+	while (1) {
+		struct bpos batch_start = iter.pos;
+		unsigned nr = 0;
+
+		bch2_trans_begin(trans);
+
+		while (nr < REFLINK_DROPS_BATCH &&
+		       trans->nr_updates < REFLINK_DROPS_MAX_UPDATES) {
+			k = bch2_btree_iter_peek(&iter);
+			ret = bkey_err(k);
+			if (ret || !k.k)
+				break;
+
+			if (k.k->type == KEY_TYPE_reflink_drop) {
+				ret = reflink_drop_apply(trans, bkey_s_c_to_reflink_drop(k));
+				if (ret)
+					break;
+			}
+
+			ret = bch2_btree_delete_at(trans, &iter, 0);
+			if (ret)
+				break;
+
+			bch2_btree_iter_advance(&iter);
+			nr++;
+		}
+
+		if (!ret && nr)
+			ret = bch2_trans_commit(trans, NULL, NULL,
+						BCH_TRANS_COMMIT_no_enospc);
+
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart)) {
+			bch2_btree_iter_set_pos(&iter, batch_start);
+			continue;
+		}
+
+		if (ret || !nr)
+			break;
+
+		*nr_applied += nr;
+	}
+
+	bch2_trans_iter_exit(trans, &iter);
+	return ret;
+}
+
+static void bch2_do_reflink_drops_work(struct work_struct *work)
+{
+	struct bch_fs *c = container_of(work, struct bch_fs, reflink_drops_work);
+	struct btree_trans *trans = bch2_trans_get(c);
+	u64 nr;
+	int ret;
+
+	/*
+	 * Kicked after a write buffer flush that included drops (and when going
+	 * rw): only apply what's already in the btree, don't force a flush
+	 */
+	ret = bch2_reflink_drops_apply(trans, &nr);
+
+	bch2_trans_put(trans);
+	bch_err_fn(c, ret);
+	bch2_write_ref_put(c, BCH_WRITE_REF_reflink_drops);
+}
+
+void bch2_do_reflink_drops(struct bch_fs *c)
+{
+	if (bch2_reflink_drops_deferred(c) &&
+	    bch2_write_ref_tryget(c, BCH_WRITE_REF_reflink_drops) &&
+	    !queue_work(c->write_ref_wq, &c->reflink_drops_work))
+		bch2_write_ref_put(c, BCH_WRITE_REF_reflink_drops);
+}
+
 static int bch2_make_extent_indirect(struct btree_trans *trans,
 				     struct btree_iter *extent_iter,
 				     struct bkey_i *orig)
@@ -349,8 +560,12 @@ static int bch2_make_extent_indirect(struct btree_trans *trans,
 	if (orig->k.type == KEY_TYPE_inline_data)
 		bch2_check_set_feature(c, BCH_FEATURE_reflink_inline_data);
 
+	/*
+	 * WITH_UPDATES: we may be converting several extents in the same
+	 * transaction, and each needs its own slot at the end of the btree:
+	 */
 	bch2_trans_iter_init(trans, &reflink_iter, BTREE_ID_reflink, POS_MAX,
-			     BTREE_ITER_INTENT);
+			     BTREE_ITER_INTENT|BTREE_ITER_WITH_UPDATES);
 	k = bch2_btree_iter_peek_prev(&reflink_iter);
 	ret = bkey_err(k);
 	if (ret)
@@ -420,6 +635,141 @@ static struct bkey_s_c get_next_src(struct btree_iter *iter, struct bpos end)
 	return ret ? bkey_s_c_err(ret) : bkey_s_c_null;
 }
 
+/*
+ * Max number of extents converted to indirect per transaction, and max number
+ * of source reflink pointers merged into one destination reflink pointer - the
+ * reflink_p trigger updates the refcount of every indirect extent it points
+ * to, in the same transaction:
+ */
+#define REFLINK_INDIRECT_BATCH	32
+#define REFLINK_MERGE_MAX	16
+
+/*
+ * Convert the source range to indirect extents up front, many extents per
+ * transaction instead of one per remap iteration: since indirect extents are
+ * allocated at the end of the reflink btree, extents converted together also
+ * get contiguous indices, which lets the remap loop cover them with a single
+ * reflink pointer.
+ */
+static int bch2_make_range_indirect(struct btree_trans *trans,
+				    subvol_inum inum,
+				    struct bpos start, struct bpos end)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	struct bpos batch_start;
+	u32 snapshot;
+	unsigned nr;
+	int ret = 0;
+
+	bch2_trans_iter_init(trans, &iter, BTREE_ID_extents, start,
+			     BTREE_ITER_INTENT);
+
+	while ((ret == 0 ||
+		bch2_err_matches(ret, BCH_ERR_transaction_restart)) &&
+	       bkey_lt(iter.pos, end)) {
+		bch2_trans_begin(trans);
+
+		if (fatal_signal_pending(current)) {
+			ret = -EINTR;
+			break;
+		}
+
+		ret = bch2_subvolume_get_snapshot(trans, inum.subvol, &snapshot);
+		if (ret)
+			continue;
+
+		bch2_btree_iter_set_snapshot(&iter, snapshot);
+
+		batch_start = iter.pos;
+		nr = 0;
+
+		while (nr < REFLINK_INDIRECT_BATCH) {
+			struct btree_iter extent_iter;
+			struct bkey_i *orig;
+			struct bpos next;
+
+			k = get_next_src(&iter, end);
+			ret = bkey_err(k);
+			if (ret || !k.k)
+				break;
+
+			next = k.k->p;
+
+			if (k.k->type != KEY_TYPE_reflink_p) {
+				/* bch2_make_extent_indirect() turns orig into a reflink_p: */
+				orig = bch2_trans_kmalloc(trans,
+						max_t(unsigned, bkey_bytes(k.k),
+						      sizeof(struct bkey_i_reflink_p)));
+				ret = PTR_ERR_OR_ZERO(orig);
+				if (ret)
+					break;
+
+				bkey_reassemble(orig, k);
+
+				bch2_trans_copy_iter(&extent_iter, &iter);
+				bch2_btree_iter_set_pos_to_extent_start(&extent_iter);
+				ret = bch2_make_extent_indirect(trans, &extent_iter, orig);
+				bch2_trans_iter_exit(trans, &extent_iter);
+				if (ret)
+					break;
+			}
+
+			bch2_btree_iter_set_pos(&iter, next);
+			nr++;
+		}
+
+		ret = ret ?: bch2_trans_commit(trans, NULL, NULL,
+					       BCH_TRANS_COMMIT_no_enospc);
+		if (bch2_err_matches(ret, BCH_ERR_transaction_restart))
+			bch2_btree_iter_set_pos(&iter, batch_start);
+		else if (!ret && !k.k)
+			break;
+	}
+	bch2_trans_iter_exit(trans, &iter);
+
+	return ret;
+}
+
+/*
+ * Source reflink pointers that are adjacent in the file and point to
+ * contiguous ranges of the reflink btree can be remapped with a single
+ * reflink pointer: returns the end of the run starting at @src_k. The run
+ * isn't extended past KEY_SIZE_MAX from the start of @src_k, but the caller
+ * must still clamp the size of the merged key.
+ */
+static int reflink_p_contiguous_end(struct btree_trans *trans,
+				    struct btree_iter *src_iter,
+				    struct bkey_s_c src_k,
+				    struct bpos end, u64 *ret_end)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k;
+	u64 idx = le64_to_cpu(bkey_s_c_to_reflink_p(src_k).v->idx) + src_k.k->size;
+	unsigned nr = 1;
+	int ret;
+
+	*ret_end = src_k.k->p.offset;
+
+	bch2_trans_copy_iter(&iter, src_iter);
+	bch2_btree_iter_set_pos(&iter, src_k.k->p);
+
+	for_each_btree_key_upto_continue_norestart(iter, end, 0, k, ret) {
+		if (k.k->type != KEY_TYPE_reflink_p ||
+		    bkey_start_offset(k.k) != *ret_end ||
+		    le64_to_cpu(bkey_s_c_to_reflink_p(k).v->idx) != idx ||
+		    k.k->p.offset - bkey_start_offset(src_k.k) > KEY_SIZE_MAX ||
+		    nr++ >= REFLINK_MERGE_MAX)
+			break;
+
+		idx		+= k.k->size;
+		*ret_end	 = k.k->p.offset;
+	}
+	bch2_trans_iter_exit(trans, &iter);
+
+	return ret;
+}
+
 s64 bch2_remap_range(struct bch_fs *c,
 		     subvol_inum dst_inum, u64 dst_offset,
 		     subvol_inum src_inum, u64 src_offset,
@@ -435,7 +785,7 @@ s64 bch2_remap_range(struct bch_fs *c,
 	struct bpos dst_end = dst_start, src_end = src_start;
 	struct bch_io_opts opts;
 	struct bpos src_want;
-	u64 dst_done = 0;
+	u64 dst_done = 0, src_run_end;
 	u32 dst_snapshot, src_snapshot;
 	int ret = 0, ret2 = 0;
 
@@ -451,7 +801,8 @@ s64 bch2_remap_range(struct bch_fs *c,
 	bch2_bkey_buf_init(&new_src);
 	trans = bch2_trans_get(c);
 
-	ret = bch2_inum_opts_get(trans, src_inum, &opts);
+	ret =   bch2_inum_opts_get(trans, src_inum, &opts) ?:
+		bch2_make_range_indirect(trans, src_inum, src_start, src_end);
 	if (ret)
 		goto err;
 
@@ -540,10 +891,16 @@ s64 bch2_remap_range(struct bch_fs *c,
 			BUG();
 		}
 
+		ret = reflink_p_contiguous_end(trans, &src_iter, src_k,
+					       src_end, &src_run_end);
+		if (ret)
+			continue;
+
 		new_dst.k->k.p = dst_iter.pos;
 		bch2_key_resize(&new_dst.k->k,
-				min(src_k.k->p.offset - src_want.offset,
-				    dst_end.offset - dst_iter.pos.offset));
+				min3(src_run_end - src_want.offset,
+				     dst_end.offset - dst_iter.pos.offset,
+				     (u64) KEY_SIZE_MAX));
 
 		ret =   bch2_bkey_set_needs_rebalance(c, new_dst.k, &opts) ?:
 			bch2_extent_update(trans, dst_inum, &dst_iter,
@@ -589,3 +946,8 @@ s64 bch2_remap_range(struct bch_fs *c,
 
 	return dst_done ?: ret ?: ret2;
 }
+
+void bch2_fs_reflink_init(struct bch_fs *c)
+{
+	INIT_WORK(&c->reflink_drops_work, bch2_do_reflink_drops_work);
+}
@@ -51,6 +51,17 @@ int bch2_trigger_indirect_inline_data(struct btree_trans *,
 	.min_val_size	= 8,					\
 })
 
+int bch2_reflink_drop_invalid(struct bch_fs *, struct bkey_s_c,
+			      enum bkey_invalid_flags, struct printbuf *);
+void bch2_reflink_drop_to_text(struct printbuf *, struct bch_fs *,
+			       struct bkey_s_c);
+
+#define bch2_bkey_ops_reflink_drop ((struct bkey_ops) {	\
+	.key_invalid	= bch2_reflink_drop_invalid,		\
+	.val_to_text	= bch2_reflink_drop_to_text,		\
+	.min_val_size	= 16,					\
+})
+
 static inline const __le64 *bkey_refcount_c(struct bkey_s_c k)
 {
 	switch (k.k->type) {
@@ -75,7 +86,37 @@ static inline __le64 *bkey_refcount(struct bkey_s k)
 	}
 }
 
+/*
+ * With reflink_drops, removing a reflink pointer doesn't touch the indirect
+ * extents it points to: see struct bch_reflink_drop.
+ */
+static inline bool bch2_reflink_drops_deferred(struct bch_fs *c)
+{
+	return c->sb.version >= bcachefs_metadata_version_reflink_drops;
+}
+
+/* Index of the first entry in reflink_gc_table that ends after @idx: */
+static inline size_t bch2_reflink_gc_idx(struct bch_fs *c, u64 idx)
+{
+	size_t l = 0, r = c->reflink_gc_nr;
+
+	while (l < r) {
+		size_t m = l + (r - l) / 2;
+		struct reflink_gc *ref = genradix_ptr(&c->reflink_gc_table, m);
+		if (ref->offset <= idx)
+			l = m + 1;
+		else
+			r = m;
+	}
+
+	return l;
+}
+
+void bch2_do_reflink_drops(struct bch_fs *);
+
 s64 bch2_remap_range(struct bch_fs *, subvol_inum, u64,
 		     subvol_inum, u64, u64, u64, s64 *);
 
+void bch2_fs_reflink_init(struct bch_fs *);
+
 #endif /* _BCACHEFS_REFLINK_H */
@@ -30,4 +30,19 @@ struct bch_indirect_inline_data {
 	u8			data[];
 };
 
+/*
+ * A reference dropped by a reflink pointer that hasn't yet been applied to the
+ * indirect extents it pointed to: removing a reflink pointer only inserts one
+ * of these, via the btree write buffer, and a background job folds them into
+ * the refcounts of every indirect extent in [start, end).
+ *
+ * Only decrements are deferred, so the refcount of an indirect extent is never
+ * lower than the real number of references to it.
+ */
+struct bch_reflink_drop {
+	struct bch_val		v;
+	__le64			start;
+	__le64			end;
+} __packed __aligned(8);
+
 #endif /* _BCACHEFS_REFLINK_FORMAT_H */
@@ -6,6 +6,7 @@
 #include "replicas.h"
 #include "super-io.h"
 
+#include <linux/jhash.h>
 #include <linux/sort.h>
 
 static int bch2_cpu_replicas_to_sb_replicas(struct bch_fs *,
@@ -240,12 +241,64 @@ static inline int __replicas_entry_idx(struct bch_replicas_cpu *r,
 	return idx < r->nr ? idx : -1;
 }
 
+static inline u32 replicas_entry_hash(struct bch_replicas_entry_v1 *e)
+{
+	return jhash(e, replicas_entry_bytes(e), 0);
+}
+
+static u32 *replicas_hash_build(struct bch_replicas_cpu *r, unsigned *mask)
+{
+	unsigned i, size = roundup_pow_of_two(max(r->nr * 2, 8U));
+	u32 *table = kvcalloc(size, sizeof(*table), GFP_KERNEL);
+
+	if (!table)
+		return NULL;
+
+	for (i = 0; i < r->nr; i++) {
+		unsigned slot = replicas_entry_hash(cpu_replicas_entry(r, i)) & (size - 1);
+
+		while (table[slot])
+			slot = (slot + 1) & (size - 1);
+		table[slot] = i + 1;
+	}
+
+	*mask = size - 1;
+	return table;
+}
+
+static inline int replicas_hash_entry_idx(struct bch_fs *c,
+					  struct bch_replicas_entry_v1 *search)
+{
+	struct bch_replicas_cpu *r = &c->replicas;
+	struct bch_replicas_hash *h = &c->replicas_hash;
+	unsigned slot, entry_size = replicas_entry_bytes(search);
+
+	if (unlikely(!h->table))
+		return __replicas_entry_idx(r, search);
+
+	if (unlikely(entry_size > r->entry_size))
+		return -1;
+
+	verify_replicas_entry(search);
+
+	for (slot = replicas_entry_hash(search) & h->mask;
+	     h->table[slot];
+	     slot = (slot + 1) & h->mask) {
+		unsigned idx = h->table[slot] - 1;
+
+		if (!memcmp(cpu_replicas_entry(r, idx), search, entry_size))
+			return idx;
+	}
+
+	return -1;
+}
+
 int bch2_replicas_entry_idx(struct bch_fs *c,
 			    struct bch_replicas_entry_v1 *search)
 {
 	bch2_replicas_entry_sort(search);
 
-	return __replicas_entry_idx(&c->replicas, search);
+	return replicas_hash_entry_idx(c, search);
 }
 
 static bool __replicas_has_entry(struct bch_replicas_cpu *r,
@@ -265,7 +318,7 @@ bool bch2_replicas_marked(struct bch_fs *c,
 	verify_replicas_entry(search);
 
 	percpu_down_read(&c->mark_lock);
-	marked = __replicas_has_entry(&c->replicas, search) &&
+	marked = replicas_hash_entry_idx(c, search) >= 0 &&
 		(likely((!c->replicas_gc.entries)) ||
 		 __replicas_has_entry(&c->replicas_gc, search));
 	percpu_up_read(&c->mark_lock);
@@ -320,6 +373,7 @@ static int replicas_table_update(struct bch_fs *c,
 	struct bch_fs_usage_online *new_scratch = NULL;
 	struct bch_fs_usage __percpu *new_gc = NULL;
 	struct bch_fs_usage *new_base = NULL;
+	struct bch_replicas_hash new_hash = { 0 };
 	unsigned i, bytes = sizeof(struct bch_fs_usage) +
 		sizeof(u64) * new_r->nr;
 	unsigned scratch_bytes = sizeof(struct bch_fs_usage_online) +
@@ -336,7 +390,8 @@ static int replicas_table_update(struct bch_fs *c,
 	if (!(new_base = kzalloc(bytes, GFP_KERNEL)) ||
 	    !(new_scratch  = kmalloc(scratch_bytes, GFP_KERNEL)) ||
 	    (c->usage_gc &&
-	     !(new_gc = __alloc_percpu_gfp(bytes, sizeof(u64), GFP_KERNEL))))
+	     !(new_gc = __alloc_percpu_gfp(bytes, sizeof(u64), GFP_KERNEL))) ||
+	    !(new_hash.table = replicas_hash_build(new_r, &new_hash.mask)))
 		goto err;
 
 	for (i = 0; i < ARRAY_SIZE(new_usage); i++)
@@ -356,7 +411,9 @@ static int replicas_table_update(struct bch_fs *c,
 	swap(c->usage_scratch,	new_scratch);
 	swap(c->usage_gc,	new_gc);
 	swap(c->replicas,	*new_r);
+	swap(c->replicas_hash,	new_hash);
 out:
+	kvfree(new_hash.table);
 	free_percpu(new_gc);
 	kfree(new_scratch);
 	for (i = 0; i < ARRAY_SIZE(new_usage); i++)
@@ -1041,6 +1098,7 @@ void bch2_fs_replicas_exit(struct bch_fs *c)
 		free_percpu(c->usage[i]);
 	kfree(c->usage_base);
 	kfree(c->replicas.entries);
+	kvfree(c->replicas_hash.table);
 	kfree(c->replicas_gc.entries);
 
 	mempool_exit(&c->replicas_delta_pool);
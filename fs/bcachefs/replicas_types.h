@@ -8,6 +8,16 @@ struct bch_replicas_cpu {
 	struct bch_replicas_entry_v1 *entries;
 };
 
+/*
+ * Open addressing hash table indexing c->replicas, so that triggers can look up
+ * replicas entries without a binary search; slots hold entry index + 1, 0 if
+ * empty:
+ */
+struct bch_replicas_hash {
+	unsigned		mask;
+	u32			*table;
+};
+
 struct replicas_delta {
 	s64			delta;
 	struct bch_replicas_entry_v1 r;
@@ -81,7 +81,11 @@
 	x(trans_restart_write_buffer_flush,		75)	\
 	x(trans_restart_split_race,			76)	\
 	x(write_buffer_flush_slowpath,			77)	\
-	x(write_buffer_flush_sync,			78)
+	x(write_buffer_flush_sync,			78)	\
+	x(read_promote_hit,				79)	\
+	x(read_nopromote_cold,				80)	\
+	x(cached_extent_rescue,				81)	\
+	x(move_extent_coalesced,			82)
 
 enum bch_persistent_counters {
 #define x(t, n, ...) BCH_COUNTER_##t,
@@ -262,7 +262,8 @@
 	x(subvol_fs_path_parent_wrong,				254)	\
 	x(subvol_root_fs_path_parent_nonzero,			255)	\
 	x(subvol_children_not_set,				256)	\
-	x(subvol_children_bad,					257)
+	x(subvol_children_bad,					257)	\
+	x(reflink_drop_bad_range,				258)
 
 enum bch_sb_error_id {
 #define x(t, n) BCH_FSCK_ERR_##t = n,
@@ -49,29 +49,38 @@
 #include <linux/bitops.h>
 #include <linux/string.h>
 
+#if defined(CONFIG_DCACHE_WORD_ACCESS) && BITS_PER_LONG == 64
+#include <linux/dcache.h>
+#include <asm/word-at-a-time.h>
+#endif
+
 #include "siphash.h"
 
+static __always_inline void SipRound(u64 *v)
+{
+	v[0] += v[1];
+	v[2] += v[3];
+	v[1] = rol64(v[1], 13);
+	v[3] = rol64(v[3], 16);
+
+	v[1] ^= v[0];
+	v[3] ^= v[2];
+	v[0] = rol64(v[0], 32);
+
+	v[2] += v[1];
+	v[0] += v[3];
+	v[1] = rol64(v[1], 17);
+	v[3] = rol64(v[3], 21);
+
+	v[1] ^= v[2];
+	v[3] ^= v[0];
+	v[2] = rol64(v[2], 32);
+}
+
 static void SipHash_Rounds(SIPHASH_CTX *ctx, int rounds)
 {
-	while (rounds--) {
-		ctx->v[0] += ctx->v[1];
-		ctx->v[2] += ctx->v[3];
-		ctx->v[1] = rol64(ctx->v[1], 13);
-		ctx->v[3] = rol64(ctx->v[3], 16);
-
-		ctx->v[1] ^= ctx->v[0];
-		ctx->v[3] ^= ctx->v[2];
-		ctx->v[0] = rol64(ctx->v[0], 32);
-
-		ctx->v[2] += ctx->v[1];
-		ctx->v[0] += ctx->v[3];
-		ctx->v[1] = rol64(ctx->v[1], 17);
-		ctx->v[3] = rol64(ctx->v[3], 21);
-
-		ctx->v[1] ^= ctx->v[2];
-		ctx->v[3] ^= ctx->v[0];
-		ctx->v[2] = rol64(ctx->v[2], 32);
-	}
+	while (rounds--)
+		SipRound(ctx->v);
 }
 
 static void SipHash_CRounds(SIPHASH_CTX *ctx, const void *ptr, int rounds)
@@ -171,3 +180,121 @@ u64 SipHash(const SIPHASH_KEY *key, int rc, int rf, const void *src, size_t len)
 	SipHash_Update(&ctx, rc, rf, src, len);
 	return SipHash_End(&ctx, rc, rf);
 }
+
+/*
+ * One shot SipHash-2-4, for hashing a single buffer: equivalent to
+ * SipHash24_Init() + a single SipHash24_Update() + SipHash24_End(), but reads
+ * the input a word at a time with no copying through ctx->buf, and with no
+ * streaming state to maintain:
+ */
+
+static __always_inline void SipHash24_Start(u64 *v, const SIPHASH_KEY *key)
+{
+	u64 k0 = le64_to_cpu(key->k0);
+	u64 k1 = le64_to_cpu(key->k1);
+
+	v[0] = 0x736f6d6570736575ULL ^ k0;
+	v[1] = 0x646f72616e646f6dULL ^ k1;
+	v[2] = 0x6c7967656e657261ULL ^ k0;
+	v[3] = 0x7465646279746573ULL ^ k1;
+}
+
+static __always_inline void SipHash24_Block(u64 *v, u64 m)
+{
+	v[3] ^= m;
+	SipRound(v);
+	SipRound(v);
+	v[0] ^= m;
+}
+
+/* Last block: the trailing 0-7 bytes, and the low byte of the length: */
+static __always_inline u64 SipHash24_Tail(const u8 *p, size_t len)
+{
+	unsigned left = len & 7;
+	u64 b = (u64) len << 56;
+
+#if defined(CONFIG_DCACHE_WORD_ACCESS) && BITS_PER_LONG == 64
+	if (left)
+		b |= le64_to_cpu((__force __le64) (load_unaligned_zeropad(p) &
+						   bytemask_from_count(left)));
+#else
+	switch (left) {
+	case 7: b |= ((u64) p[6]) << 48;	fallthrough;
+	case 6: b |= ((u64) p[5]) << 40;	fallthrough;
+	case 5: b |= ((u64) p[4]) << 32;	fallthrough;
+	case 4: b |= get_unaligned_le32(p);	break;
+	case 3: b |= ((u64) p[2]) << 16;	fallthrough;
+	case 2: b |= get_unaligned_le16(p);	break;
+	case 1: b |= p[0];
+	}
+#endif
+	return b;
+}
+
+static __always_inline u64 SipHash24_Finish(u64 *v, u64 b)
+{
+	SipHash24_Block(v, b);
+	v[2] ^= 0xff;
+	SipRound(v);
+	SipRound(v);
+	SipRound(v);
+	SipRound(v);
+
+	return (v[0] ^ v[1]) ^ (v[2] ^ v[3]);
+}
+
+u64 SipHash24(const SIPHASH_KEY *key, const void *src, size_t len)
+{
+	const u8 *p = src, *end = p + (len & ~7);
+	u64 v[4];
+
+	SipHash24_Start(v, key);
+
+	for (; p != end; p += 8)
+		SipHash24_Block(v, get_unaligned_le64(p));
+
+	return SipHash24_Finish(v, SipHash24_Tail(p, len));
+}
+
+/*
+ * Hash two buffers with the same key at once: the two hash states are
+ * independent, so interleaving them gives the CPU two dependency chains to
+ * execute in parallel instead of one.
+ */
+void SipHash24_x2(const SIPHASH_KEY *key,
+		  const void *src0, size_t len0,
+		  const void *src1, size_t len1,
+		  u64 *dst)
+{
+	const u8 *p0 = src0, *end0 = p0 + (len0 & ~7);
+	const u8 *p1 = src1, *end1 = p1 + (len1 & ~7);
+	u64 v0[4], v1[4];
+
+	SipHash24_Start(v0, key);
+	memcpy(v1, v0, sizeof(v1));
+
+	while (p0 != end0 && p1 != end1) {
+		u64 m0 = get_unaligned_le64(p0);
+		u64 m1 = get_unaligned_le64(p1);
+
+		v0[3] ^= m0;
+		v1[3] ^= m1;
+		SipRound(v0);
+		SipRound(v1);
+		SipRound(v0);
+		SipRound(v1);
+		v0[0] ^= m0;
+		v1[0] ^= m1;
+
+		p0 += 8;
+		p1 += 8;
+	}
+
+	for (; p0 != end0; p0 += 8)
+		SipHash24_Block(v0, get_unaligned_le64(p0));
+	for (; p1 != end1; p1 += 8)
+		SipHash24_Block(v1, get_unaligned_le64(p1));
+
+	dst[0] = SipHash24_Finish(v0, SipHash24_Tail(p0, len0));
+	dst[1] = SipHash24_Finish(v1, SipHash24_Tail(p1, len1));
+}
@@ -140,6 +140,53 @@ static inline u64 bch2_str_hash_end(struct bch_str_hash_ctx *ctx,
 	}
 }
 
+/*
+ * Hash a single buffer: same result as bch2_str_hash_init() +
+ * bch2_str_hash_update() + bch2_str_hash_end(), but faster for siphash.
+ *
+ * Note that this is only equivalent for a single update - SipHash_Update()
+ * doesn't correctly handle being called with a partial block buffered, and
+ * on disk hashes depend on that (xattrs), so those must keep using the
+ * streaming interface:
+ */
+static inline u64 bch2_str_hash(const struct bch_hash_info *info,
+				const void *data, size_t len)
+{
+	struct bch_str_hash_ctx ctx;
+
+	switch (info->type) {
+	case BCH_STR_HASH_siphash_old:
+	case BCH_STR_HASH_siphash:
+		return SipHash24(&info->siphash_key, data, len) >> 1;
+	default:
+		bch2_str_hash_init(&ctx, info);
+		bch2_str_hash_update(&ctx, info, data, len);
+		return bch2_str_hash_end(&ctx, info);
+	}
+}
+
+/* Hash many names with the same key, e.g. all the dirents in a directory: */
+static inline void bch2_str_hash_multi(const struct bch_hash_info *info,
+				       unsigned nr, const struct qstr *names,
+				       u64 *hashes)
+{
+	unsigned i = 0;
+
+	if (info->type == BCH_STR_HASH_siphash_old ||
+	    info->type == BCH_STR_HASH_siphash)
+		for (; i + 1 < nr; i += 2) {
+			SipHash24_x2(&info->siphash_key,
+				     names[i].name,	names[i].len,
+				     names[i + 1].name,	names[i + 1].len,
+				     hashes + i);
+			hashes[i]	>>= 1;
+			hashes[i + 1]	>>= 1;
+		}
+
+	for (; i < nr; i++)
+		hashes[i] = bch2_str_hash(info, names[i].name, names[i].len);
+}
+
 struct bch_hash_desc {
 	enum btree_id	btree_id;
 	u8		key_type;
@@ -277,7 +324,8 @@ int bch2_hash_set_in_snapshot(struct btree_trans *trans,
 				desc.hash_bkey(info, bkey_i_to_s_c(insert)),
 				snapshot),
 			   POS(insert->k.p.inode, U64_MAX),
-			   BTREE_ITER_SLOTS|BTREE_ITER_INTENT, k, ret) {
+			   BTREE_ITER_SLOTS|BTREE_ITER_INTENT|
+			   BTREE_ITER_WITH_UPDATES, k, ret) {
 		if (is_visible_key(desc, inum, k)) {
 			if (!desc.cmp_bkey(k, bkey_i_to_s_c(insert)))
 				goto found;
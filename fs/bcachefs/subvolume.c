@@ -3,6 +3,7 @@
 #include "bcachefs.h"
 #include "btree_key_cache.h"
 #include "btree_update.h"
+#include "dirent_cache.h"
 #include "errcode.h"
 #include "error.h"
 #include "fs.h"
@@ -449,6 +450,8 @@ static void bch2_subvolume_wait_for_pagecache_and_delete(struct work_struct *wor
 		for (id = s.data; id < s.data + s.nr; id++) {
 			ret = bch2_trans_run(c, bch2_subvolume_delete(trans, *id));
 			bch_err_msg(c, ret, "deleting subvolume %u", *id);
+			/* subvolume IDs may be reused: */
+			bch2_dirent_cache_invalidate_all(c);
 			if (ret)
 				break;
 		}
@@ -24,6 +24,7 @@
 #include "clock.h"
 #include "compress.h"
 #include "debug.h"
+#include "dirent_cache.h"
 #include "disk_groups.h"
 #include "ec.h"
 #include "errcode.h"
@@ -46,6 +47,7 @@
 #include "quota.h"
 #include "rebalance.h"
 #include "recovery.h"
+#include "reflink.h"
 #include "replicas.h"
 #include "sb-clean.h"
 #include "sb-counters.h"
@@ -56,6 +58,7 @@
 #include "super.h"
 #include "super-io.h"
 #include "sysfs.h"
+#include "tests.h"
 #include "trace.h"
 
 #include <linux/backing-dev.h>
@@ -481,6 +484,7 @@ static int __bch2_fs_read_write(struct bch_fs *c, bool early)
 	bch2_do_invalidates(c);
 	bch2_do_stripe_deletes(c);
 	bch2_do_pending_node_rewrites(c);
+	bch2_do_reflink_drops(c);
 	return 0;
 err:
 	if (test_bit(BCH_FS_rw, &c->flags))
@@ -516,8 +520,11 @@ static void __bch2_fs_free(struct bch_fs *c)
 
 	for (i = 0; i < BCH_TIME_STAT_NR; i++)
 		time_stats_exit(&c->times[i]);
+	for (i = 0; i < BTREE_ID_NR; i++)
+		time_stats_exit(&c->btree_node_read_times[i]);
 
 	bch2_free_pending_node_rewrites(c);
+	bch2_fs_tests_exit(c);
 	bch2_fs_sb_errors_exit(c);
 	bch2_fs_counters_exit(c);
 	bch2_fs_snapshots_exit(c);
@@ -533,6 +540,7 @@ static void __bch2_fs_free(struct bch_fs *c)
 	bch2_fs_buckets_waiting_for_journal_exit(c);
 	bch2_fs_btree_interior_update_exit(c);
 	bch2_fs_btree_iter_exit(c);
+	bch2_fs_dirent_cache_exit(c);
 	bch2_fs_btree_key_cache_exit(&c->btree_key_cache);
 	bch2_fs_btree_cache_exit(c);
 	bch2_fs_replicas_exit(c);
@@ -545,6 +553,7 @@ static void __bch2_fs_free(struct bch_fs *c)
 	bch2_fs_btree_write_buffer_exit(c);
 	percpu_free_rwsem(&c->mark_lock);
 	free_percpu(c->online_reserved);
+	kfree(c->sectors_available_node);
 
 	darray_exit(&c->btree_roots_extra);
 	free_percpu(c->pcpu);
@@ -557,7 +566,8 @@ static void __bch2_fs_free(struct bch_fs *c)
 #endif
 	kfree(rcu_dereference_protected(c->disk_groups, 1));
 	kfree(c->journal_seq_blacklist_table);
-	kfree(c->unused_inode_hints);
+	kfree(c->inode_alloc);
+	darray_exit(&c->inode_rm_pending);
 
 	if (c->write_ref_wq)
 		destroy_workqueue(c->write_ref_wq);
@@ -749,18 +759,22 @@ static struct bch_fs *bch2_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 
 	for (i = 0; i < BCH_TIME_STAT_NR; i++)
 		time_stats_init(&c->times[i]);
+	for (i = 0; i < BTREE_ID_NR; i++)
+		time_stats_init(&c->btree_node_read_times[i]);
 
 	bch2_fs_copygc_init(c);
 	bch2_fs_btree_key_cache_init_early(&c->btree_key_cache);
+	bch2_fs_dirent_cache_init_early(c);
 	bch2_fs_btree_iter_init_early(c);
 	bch2_fs_btree_interior_update_init_early(c);
 	bch2_fs_allocator_background_init(c);
 	bch2_fs_allocator_foreground_init(c);
 	bch2_fs_rebalance_init(c);
-	bch2_fs_quota_init(c);
+	bch2_fs_reflink_init(c);
 	bch2_fs_ec_init_early(c);
 	bch2_fs_move_init(c);
 	bch2_fs_sb_errors_init_early(c);
+	bch2_fs_tests_init_early(c);
 
 	INIT_LIST_HEAD(&c->list);
 
@@ -783,6 +797,8 @@ static struct bch_fs *bch2_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 	seqcount_init(&c->gc_pos_lock);
 
 	seqcount_init(&c->usage_lock);
+	seqlock_init(&c->usage_cache.lock);
+	mutex_init(&c->usage_cache.refresh_lock);
 
 	sema_init(&c->io_in_flight, 128);
 
@@ -792,6 +808,8 @@ static struct bch_fs *bch2_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 	c->copy_gc_enabled		= 1;
 	c->rebalance.enabled		= 1;
 	c->promote_whole_extents	= true;
+	c->promote_min_reads		= 2;
+	c->cache_hot_reads		= 2;
 
 	c->journal.flush_write_time	= &c->times[BCH_TIME_journal_flush_write];
 	c->journal.noflush_write_time	= &c->times[BCH_TIME_journal_noflush_write];
@@ -876,12 +894,14 @@ static struct bch_fs *bch2_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 			    offsetof(struct btree_write_bio, wbio.bio)),
 			BIOSET_NEED_BVECS) ||
 	    !(c->pcpu = alloc_percpu(struct bch_fs_pcpu)) ||
+	    !(c->sectors_available_node = kcalloc(nr_node_ids,
+				sizeof(*c->sectors_available_node), GFP_KERNEL)) ||
 	    !(c->online_reserved = alloc_percpu(u64)) ||
 	    mempool_init_kvmalloc_pool(&c->btree_bounce_pool, 1,
 				       c->opts.btree_node_size) ||
 	    mempool_init_kmalloc_pool(&c->large_bkey_pool, 1, 2048) ||
-	    !(c->unused_inode_hints = kcalloc(1U << c->inode_shard_bits,
-					      sizeof(u64), GFP_KERNEL))) {
+	    !(c->inode_alloc = kcalloc(1U << c->inode_shard_bits,
+				       sizeof(*c->inode_alloc), GFP_KERNEL))) {
 		ret = -BCH_ERR_ENOMEM_fs_other_alloc;
 		goto err;
 	}
@@ -899,6 +919,9 @@ static struct bch_fs *bch2_fs_alloc(struct bch_sb *sb, struct bch_opts opts)
 	    bch2_fs_buckets_waiting_for_journal_init(c) ?:
 	    bch2_fs_btree_write_buffer_init(c) ?:
 	    bch2_fs_subvolumes_init(c) ?:
+	    bch2_fs_inode_init(c) ?:
+	    bch2_fs_quota_init(c) ?:
+	    bch2_fs_dirent_cache_init(c) ?:
 	    bch2_fs_io_read_init(c) ?:
 	    bch2_fs_io_write_init(c) ?:
 	    bch2_fs_nocow_locking_init(c) ?:
@@ -1390,6 +1413,103 @@ static int bch2_dev_attach_bdev(struct bch_fs *c, struct bch_sb_handle *sb)
 	return 0;
 }
 
+/* Latency histograms: */
+
+const char * const bch2_time_stats_strs[] = {
+#define x(name) #name,
+	BCH_TIME_STATS()
+#undef x
+	NULL
+};
+
+/*
+ * Histograms are enabled for everything at once: devices added after this is
+ * called don't record histograms until it's called again.
+ */
+int bch2_fs_time_stats_hist_enable(struct bch_fs *c)
+{
+	int ret = 0;
+
+	for (unsigned i = 0; i < BCH_TIME_STAT_NR && !ret; i++)
+		ret = time_stats_hist_enable(&c->times[i]);
+	for (unsigned i = 0; i < BTREE_ID_NR && !ret; i++)
+		ret = time_stats_hist_enable(&c->btree_node_read_times[i]);
+	if (ret)
+		return ret;
+
+	for_each_member_device(c, ca) {
+		ret =   time_stats_hist_enable(&ca->io_latency[READ].stats) ?:
+			time_stats_hist_enable(&ca->io_latency[WRITE].stats);
+		if (ret) {
+			percpu_ref_put(&ca->ref);
+			break;
+		}
+	}
+
+	return ret;
+}
+
+bool bch2_fs_time_stats_hist_enabled(struct bch_fs *c)
+{
+	return READ_ONCE(c->times[0].hist) != NULL;
+}
+
+/*
+ * Read the histogram selected by @h->kind and @h->idx into @buckets (which must
+ * have room for TIME_STATS_HIST_NR entries), filling in the rest of @h:
+ */
+int bch2_fs_time_stats_hist_read(struct bch_fs *c,
+				 struct bch_time_stats_hist_header *h,
+				 u64 *buckets)
+{
+	struct bch_dev *ca = NULL;
+	bool enabled;
+
+	h->sub_bits	= TIME_STATS_HIST_SUB_BITS;
+	h->nr_buckets	= TIME_STATS_HIST_NR;
+	memset(h->name, 0, sizeof(h->name));
+
+	switch (h->kind) {
+	case BCH_TIME_HIST_fs:
+		if (h->idx >= BCH_TIME_STAT_NR)
+			return -EINVAL;
+
+		strscpy(h->name, bch2_time_stats_strs[h->idx], sizeof(h->name));
+		enabled = time_stats_hist_read(&c->times[h->idx], buckets);
+		break;
+	case BCH_TIME_HIST_dev_read:
+	case BCH_TIME_HIST_dev_write:
+		rcu_read_lock();
+		ca = h->idx < c->sb.nr_devices
+			? rcu_dereference(c->devs[h->idx])
+			: NULL;
+		if (ca)
+			percpu_ref_get(&ca->ref);
+		rcu_read_unlock();
+
+		if (!ca)
+			return -BCH_ERR_ENOENT_dev_idx_not_found;
+
+		strscpy(h->name, ca->name, sizeof(h->name));
+		enabled = time_stats_hist_read(&ca->io_latency[h->kind == BCH_TIME_HIST_dev_read
+							       ? READ : WRITE].stats,
+					       buckets);
+		percpu_ref_put(&ca->ref);
+		break;
+	case BCH_TIME_HIST_btree_node_read:
+		if (h->idx >= BTREE_ID_NR)
+			return -EINVAL;
+
+		strscpy(h->name, bch2_btree_id_str(h->idx), sizeof(h->name));
+		enabled = time_stats_hist_read(&c->btree_node_read_times[h->idx], buckets);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	return enabled ? 0 : -BCH_ERR_ENOENT_time_stats_hist;
+}
+
 /* Device management: */
 
 /*
@@ -44,6 +44,12 @@ static inline void bch2_fs_lazy_rw(struct bch_fs *c)
 		bch2_fs_read_write_early(c);
 }
 
+extern const char * const bch2_time_stats_strs[];
+
+int bch2_fs_time_stats_hist_enable(struct bch_fs *);
+bool bch2_fs_time_stats_hist_enabled(struct bch_fs *);
+int bch2_fs_time_stats_hist_read(struct bch_fs *, struct bch_time_stats_hist_header *, u64 *);
+
 void __bch2_fs_stop(struct bch_fs *);
 void bch2_fs_free(struct bch_fs *);
 void bch2_fs_stop(struct bch_fs *);
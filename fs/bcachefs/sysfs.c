@@ -22,9 +22,11 @@
 #include "buckets.h"
 #include "clock.h"
 #include "compress.h"
+#include "dirent_cache.h"
 #include "disk_groups.h"
 #include "ec.h"
 #include "inode.h"
+#include "io_read.h"
 #include "journal.h"
 #include "keylist.h"
 #include "move.h"
@@ -33,6 +35,7 @@
 #include "opts.h"
 #include "rebalance.h"
 #include "replicas.h"
+#include "super.h"
 #include "super-io.h"
 #include "tests.h"
 
@@ -169,6 +172,7 @@ read_attribute(journal_debug);
 read_attribute(btree_updates);
 read_attribute(btree_cache);
 read_attribute(btree_key_cache);
+read_attribute(dirent_cache);
 read_attribute(stripes_heap);
 read_attribute(open_buckets);
 read_attribute(open_buckets_partial);
@@ -215,9 +219,15 @@ rw_attribute(copy_gc_enabled);
 read_attribute(copy_gc_wait);
 
 rw_attribute(rebalance_enabled);
+rw_attribute(rebalance_writeback_watermark);
+rw_attribute(rebalance_writeback_throttle);
 sysfs_pd_controller_attribute(rebalance);
 read_attribute(rebalance_status);
+read_attribute(background_progress);
 rw_attribute(promote_whole_extents);
+rw_attribute(promote_min_reads);
+rw_attribute(cache_hot_reads);
+read_attribute(promote_stats);
 
 read_attribute(new_stripes);
 
@@ -236,6 +246,8 @@ write_attribute(perf_test);
 	BCH_TIME_STATS()
 #undef x
 
+rw_attribute(histograms);
+
 static struct attribute sysfs_state_rw = {
 	.name = "state",
 	.mode =  0444,
@@ -408,7 +420,18 @@ SHOW(bch2_fs)
 	if (attr == &sysfs_rebalance_status)
 		bch2_rebalance_status_to_text(out, c);
 
+	if (attr == &sysfs_background_progress)
+		bch2_background_progress_to_text(out, c);
+
+	sysfs_print(rebalance_writeback_watermark,	c->rebalance.writeback_watermark);
+	sysfs_print(rebalance_writeback_throttle,	c->rebalance.writeback_throttle);
+
 	sysfs_print(promote_whole_extents,	c->promote_whole_extents);
+	sysfs_print(promote_min_reads,		c->promote_min_reads);
+	sysfs_print(cache_hot_reads,		c->cache_hot_reads);
+
+	if (attr == &sysfs_promote_stats)
+		bch2_promote_stats_to_text(out, c);
 
 	/* Debugging: */
 
@@ -424,6 +447,9 @@ SHOW(bch2_fs)
 	if (attr == &sysfs_btree_key_cache)
 		bch2_btree_key_cache_to_text(out, &c->btree_key_cache);
 
+	if (attr == &sysfs_dirent_cache)
+		bch2_dirent_cache_to_text(out, c);
+
 	if (attr == &sysfs_stripes_heap)
 		bch2_stripes_heap_to_text(out, c);
 
@@ -491,12 +517,26 @@ STORE(bch2_fs)
 			?: (ssize_t) size;
 
 		rebalance_wakeup(c);
+		wake_up(&c->rebalance.scan_wait);
 		return ret;
 	}
 
 	sysfs_pd_controller_store(rebalance,	&c->rebalance.pd);
 
+	if (attr == &sysfs_rebalance_writeback_watermark) {
+		ssize_t ret = strtoul_safe_clamp(buf, c->rebalance.writeback_watermark, 0, 100)
+			?: (ssize_t) size;
+
+		rebalance_wakeup(c);
+		return ret;
+	}
+
+	sysfs_strtoul_clamp(rebalance_writeback_throttle,
+			    c->rebalance.writeback_throttle, 0, 100);
+
 	sysfs_strtoul(promote_whole_extents,	c->promote_whole_extents);
+	sysfs_strtoul(promote_min_reads,	c->promote_min_reads);
+	sysfs_strtoul(cache_hot_reads,		c->cache_hot_reads);
 
 	/* Debugging: */
 
@@ -551,7 +591,7 @@ STORE(bch2_fs)
 		if (threads_str &&
 		    !(ret = kstrtouint(threads_str, 10, &threads)) &&
 		    !(ret = bch2_strtoull_h(nr_str, &nr)))
-			ret = bch2_btree_perf_test(c, test, nr, threads);
+			ret = bch2_btree_perf_test(c, test, nr, threads, p);
 		kfree(tmp);
 
 		if (ret)
@@ -568,6 +608,9 @@ struct attribute *bch2_fs_files[] = {
 	&sysfs_btree_write_stats,
 
 	&sysfs_promote_whole_extents,
+	&sysfs_promote_min_reads,
+	&sysfs_cache_hot_reads,
+	&sysfs_promote_stats,
 
 	&sysfs_compression_stats,
 
@@ -642,6 +685,7 @@ struct attribute *bch2_fs_internal_files[] = {
 	&sysfs_btree_updates,
 	&sysfs_btree_cache,
 	&sysfs_btree_key_cache,
+	&sysfs_dirent_cache,
 	&sysfs_new_stripes,
 	&sysfs_stripes_heap,
 	&sysfs_open_buckets,
@@ -667,6 +711,9 @@ struct attribute *bch2_fs_internal_files[] = {
 
 	&sysfs_rebalance_enabled,
 	&sysfs_rebalance_status,
+	&sysfs_background_progress,
+	&sysfs_rebalance_writeback_watermark,
+	&sysfs_rebalance_writeback_throttle,
 	sysfs_pd_controller_files(rebalance),
 
 	&sysfs_moving_ctxts,
@@ -730,7 +777,7 @@ STORE(bch2_fs_opts_dir)
 	    (id == Opt_background_target ||
 	     id == Opt_background_compression ||
 	     (id == Opt_compression && !c->opts.background_compression)))
-		bch2_set_rebalance_needs_scan(c, 0);
+		bch2_set_fs_opt_needs_rebalance(c, id);
 
 	ret = size;
 err:
@@ -766,6 +813,8 @@ SHOW(bch2_fs_time_stats)
 {
 	struct bch_fs *c = container_of(kobj, struct bch_fs, time_stats);
 
+	sysfs_print(histograms, bch2_fs_time_stats_hist_enabled(c));
+
 #define x(name)								\
 	if (attr == &sysfs_time_stat_##name)				\
 		bch2_time_stats_to_text(out, &c->times[BCH_TIME_##name]);
@@ -777,11 +826,28 @@ SHOW(bch2_fs_time_stats)
 
 STORE(bch2_fs_time_stats)
 {
+	struct bch_fs *c = container_of(kobj, struct bch_fs, time_stats);
+
+	/* histograms can't be disabled once enabled: */
+	if (attr == &sysfs_histograms) {
+		bool v;
+		int ret = kstrtobool(buf, &v);
+
+		if (ret)
+			return ret;
+		if (v) {
+			ret = bch2_fs_time_stats_hist_enable(c);
+			if (ret)
+				return ret;
+		}
+	}
+
 	return size;
 }
 SYSFS_OPS(bch2_fs_time_stats);
 
 struct attribute *bch2_fs_time_stats_files[] = {
+	&sysfs_histograms,
 #define x(name)						\
 	&sysfs_time_stat_##name,
 	BCH_TIME_STATS()
@@ -3,12 +3,19 @@
 
 #include "bcachefs.h"
 #include "btree_update.h"
+#include "btree_write_buffer.h"
+#include "dirent.h"
+#include "inode.h"
 #include "journal_reclaim.h"
+#include "lru.h"
 #include "snapshot.h"
+#include "str_hash.h"
 #include "tests.h"
+#include "xattr.h"
 
 #include "linux/kthread.h"
 #include "linux/random.h"
+#include "linux/utsname.h"
 
 static void delete_test_keys(struct bch_fs *c)
 {
@@ -754,13 +761,469 @@ static int seq_delete(struct bch_fs *c, u64 nr)
 				      0, NULL);
 }
 
+/* string hash tests: */
+
+#define STR_HASH_TEST_NAMES	64
+
+struct str_hash_test {
+	struct bch_hash_info	info;
+	struct qstr		names[STR_HASH_TEST_NAMES];
+	char			buf[STR_HASH_TEST_NAMES * 64];
+};
+
+/* names of random length, at random alignments, like dirents: */
+static struct str_hash_test *str_hash_test_init(void)
+{
+	struct str_hash_test *t = kmalloc(sizeof(*t), GFP_KERNEL);
+	unsigned i;
+
+	if (!t)
+		return NULL;
+
+	t->info = (struct bch_hash_info) {
+		.type			= BCH_STR_HASH_siphash,
+		.siphash_key.k0		= cpu_to_le64(test_rand()),
+		.siphash_key.k1		= cpu_to_le64(test_rand()),
+	};
+
+	get_random_bytes(t->buf, sizeof(t->buf));
+
+	for (i = 0; i < STR_HASH_TEST_NAMES; i++)
+		t->names[i] = (struct qstr) QSTR_INIT(t->buf + i * 64 + test_rand() % 8,
+						      1 + test_rand() % 56);
+	return t;
+}
+
+static u64 str_hash_stream(const struct bch_hash_info *info, const struct qstr *name)
+{
+	struct bch_str_hash_ctx ctx;
+
+	bch2_str_hash_init(&ctx, info);
+	bch2_str_hash_update(&ctx, info, name->name, name->len);
+	return bch2_str_hash_end(&ctx, info);
+}
+
+/* a unit test, not a perf test: */
+static int test_str_hash(struct bch_fs *c, u64 nr)
+{
+	struct str_hash_test *t;
+	u64 hashes[STR_HASH_TEST_NAMES];
+	unsigned i;
+	int ret = 0;
+
+	while (nr) {
+		t = str_hash_test_init();
+		if (!t)
+			return -ENOMEM;
+
+		bch2_str_hash_multi(&t->info, STR_HASH_TEST_NAMES, t->names, hashes);
+
+		for (i = 0; i < STR_HASH_TEST_NAMES && nr; i++, --nr) {
+			u64 h = str_hash_stream(&t->info, &t->names[i]);
+
+			if (bch2_str_hash(&t->info, t->names[i].name, t->names[i].len) != h ||
+			    hashes[i] != h) {
+				bch_err(c, "%s: hash mismatch for name of len %u",
+					__func__, t->names[i].len);
+				ret = -EINVAL;
+				break;
+			}
+		}
+
+		kfree(t);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+static int str_hash_stream_perf(struct bch_fs *c, u64 nr)
+{
+	struct str_hash_test *t = str_hash_test_init();
+	u64 i, v = 0;
+
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++)
+		v ^= str_hash_stream(&t->info, &t->names[i % STR_HASH_TEST_NAMES]);
+
+	kfree(t);
+	return v == 1 ? -EINVAL : 0;
+}
+
+static int str_hash_perf(struct bch_fs *c, u64 nr)
+{
+	struct str_hash_test *t = str_hash_test_init();
+	u64 i, v = 0;
+
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		struct qstr *name = &t->names[i % STR_HASH_TEST_NAMES];
+
+		v ^= bch2_str_hash(&t->info, name->name, name->len);
+	}
+
+	kfree(t);
+	return v == 1 ? -EINVAL : 0;
+}
+
+static int str_hash_multi_perf(struct bch_fs *c, u64 nr)
+{
+	struct str_hash_test *t = str_hash_test_init();
+	u64 hashes[STR_HASH_TEST_NAMES];
+	u64 i, v = 0;
+
+	if (!t)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i += STR_HASH_TEST_NAMES) {
+		unsigned j, n = min_t(u64, nr - i, STR_HASH_TEST_NAMES);
+
+		bch2_str_hash_multi(&t->info, n, t->names, hashes);
+		for (j = 0; j < n; j++)
+			v ^= hashes[j];
+	}
+
+	kfree(t);
+	return v == 1 ? -EINVAL : 0;
+}
+
+/*
+ * benchmarks: unlike the perf tests above, these time every operation
+ * individually, so that we can report latency percentiles and not just
+ * throughput. Lookups and updates are timed separately, since mixing them would
+ * blur two different distributions together.
+ *
+ * Each thread owns a disjoint slice of the key space; if the workload does any
+ * reads, the slice is populated before timing starts, and all keys are deleted
+ * again once the run is finished.
+ */
+
+/* profile, value size (xattrs), name length (xattrs, dirents), extent size: */
+#define BENCH_PROFILES()			\
+	x(small,	8,	8,	8)	\
+	x(medium,	64,	32,	64)	\
+	x(large,	256,	128,	512)
+
+enum bench_profile_id {
+#define x(_name, ...)	BENCH_PROFILE_##_name,
+	BENCH_PROFILES()
+#undef x
+	BENCH_PROFILE_NR
+};
+
+static const char * const bench_profile_strs[] = {
+#define x(_name, ...)	#_name,
+	BENCH_PROFILES()
+#undef x
+	NULL
+};
+
+struct bench_profile {
+	unsigned		val_bytes;
+	unsigned		name_len;
+	unsigned		extent_sectors;
+};
+
+static const struct bench_profile bench_profiles[] = {
+#define x(_name, _val_bytes, _name_len, _extent_sectors)	\
+	[BENCH_PROFILE_##_name] = {				\
+		.val_bytes	= _val_bytes,			\
+		.name_len	= _name_len,			\
+		.extent_sectors	= _extent_sectors,		\
+	},
+	BENCH_PROFILES()
+#undef x
+};
+
+/*
+ * Out of the way of real inodes - the inode allocator never hands out numbers
+ * above 2^63 - 1, sharded or not, and numbers below BLOCKDEV_INODE_MAX aren't
+ * valid inodes - and of the lru ids that are in use:
+ */
+#define BENCH_INUM_START	(1ULL << 63)
+#define BENCH_LRU_ID		(BCH_LRU_FRAGMENTATION_START - 1)
+
+struct bench_opts {
+	enum bench_profile_id	profile;
+	/* percentage of operations that are lookups, the rest are updates: */
+	unsigned		read_pct;
+	bool			seq;
+	bool			pin;
+	bool			cached;
+};
+
+static int bench_opts_parse(struct bench_opts *opts, char *str)
+{
+	char *opt;
+	int ret = 0;
+
+	while ((opt = strsep(&str, " \t\n"))) {
+		char *val = opt, *name = strsep(&val, "=");
+
+		if (!*name)
+			continue;
+		if (!val)
+			return -EINVAL;
+
+		if (!strcmp(name, "profile")) {
+			ret = match_string(bench_profile_strs, -1, val);
+			if (ret < 0)
+				return -EINVAL;
+			opts->profile = ret;
+			ret = 0;
+		} else if (!strcmp(name, "read_pct")) {
+			ret = kstrtouint(val, 10, &opts->read_pct);
+			if (!ret && opts->read_pct > 100)
+				ret = -EINVAL;
+		} else if (!strcmp(name, "seq")) {
+			ret = kstrtobool(val, &opts->seq);
+		} else if (!strcmp(name, "pin")) {
+			ret = kstrtobool(val, &opts->pin);
+		} else if (!strcmp(name, "cached")) {
+			ret = kstrtobool(val, &opts->cached);
+		} else {
+			ret = -EINVAL;
+		}
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+struct bench_workload {
+	const char		*name;
+	enum btree_id		btree;
+	/* updates go through the btree write buffer: */
+	bool			buffered;
+	struct bpos		(*pos)(const struct bench_profile *, u64);
+	struct bkey_i		*(*key)(struct btree_trans *,
+					const struct bench_profile *, u64);
+};
+
+static struct bpos bench_hashed_pos(const struct bench_profile *p, u64 key)
+{
+	return SPOS(0, key, U32_MAX);
+}
+
+static struct bkey_i *bench_xattr_key(struct btree_trans *trans,
+				      const struct bench_profile *p, u64 key)
+{
+	unsigned u64s = BKEY_U64s + xattr_val_u64s(p->name_len, p->val_bytes);
+	struct bkey_i_xattr *x = bch2_trans_kmalloc(trans, u64s * sizeof(u64));
+
+	if (IS_ERR(x))
+		return ERR_CAST(x);
+
+	bkey_xattr_init(&x->k_i);
+	x->k.u64s	= u64s;
+	x->k.p		= bench_hashed_pos(p, key);
+	x->v.x_type	= KEY_TYPE_XATTR_INDEX_USER;
+	x->v.x_name_len	= p->name_len;
+	x->v.x_val_len	= cpu_to_le16(p->val_bytes);
+	memset(x->v.x_name, 'x', p->name_len);
+	memset(xattr_val(&x->v), 0xaa, p->val_bytes);
+	return &x->k_i;
+}
+
+static struct bkey_i *bench_dirent_key(struct btree_trans *trans,
+				       const struct bench_profile *p, u64 key)
+{
+	unsigned u64s = BKEY_U64s + dirent_val_u64s(p->name_len);
+	struct bkey_i_dirent *d = bch2_trans_kmalloc(trans, u64s * sizeof(u64));
+
+	if (IS_ERR(d))
+		return ERR_CAST(d);
+
+	bkey_dirent_init(&d->k_i);
+	d->k.u64s	= u64s;
+	d->k.p		= bench_hashed_pos(p, key);
+	d->v.d_inum	= cpu_to_le64(BENCH_INUM_START + key);
+	d->v.d_type	= DT_REG;
+	memset(d->v.d_name, 'd', p->name_len);
+	return &d->k_i;
+}
+
+static struct bpos bench_extent_pos(const struct bench_profile *p, u64 key)
+{
+	return SPOS(0, key * p->extent_sectors, U32_MAX);
+}
+
+static struct bkey_i *bench_extent_key(struct btree_trans *trans,
+				       const struct bench_profile *p, u64 key)
+{
+	struct bkey_i_cookie *k = bch2_trans_kmalloc(trans, sizeof(*k));
+
+	if (IS_ERR(k))
+		return ERR_CAST(k);
+
+	bkey_cookie_init(&k->k_i);
+	k->k.p		= bench_extent_pos(p, key + 1);
+	k->k.size	= p->extent_sectors;
+	return &k->k_i;
+}
+
+static struct bpos bench_inode_pos(const struct bench_profile *p, u64 key)
+{
+	return SPOS(0, BENCH_INUM_START + key, U32_MAX);
+}
+
+static struct bkey_i *bench_inode_key(struct btree_trans *trans,
+				      const struct bench_profile *p, u64 key)
+{
+	struct bkey_inode_buf *k = bch2_trans_kmalloc(trans, sizeof(*k));
+	struct bch_inode_unpacked u = {
+		.bi_inum	= BENCH_INUM_START + key,
+		.bi_mode	= S_IFREG|0644,
+		.bi_size	= p->val_bytes,
+	};
+
+	if (IS_ERR(k))
+		return ERR_CAST(k);
+
+	bch2_inode_pack(k, &u);
+	k->inode.k.p.snapshot = U32_MAX;
+	return &k->inode.k_i;
+}
+
+static struct bpos bench_lru_pos(const struct bench_profile *p, u64 key)
+{
+	return lru_pos(BENCH_LRU_ID, key, 1);
+}
+
+static struct bkey_i *bench_lru_key(struct btree_trans *trans,
+				    const struct bench_profile *p, u64 key)
+{
+	struct bkey_i *k = bch2_trans_kmalloc(trans, sizeof(*k));
+
+	if (IS_ERR(k))
+		return k;
+
+	bkey_init(&k->k);
+	k->k.type	= KEY_TYPE_set;
+	k->k.p		= bench_lru_pos(p, key);
+	return k;
+}
+
+static const struct bench_workload bench_workloads[] = {
+	{ "bench_xattrs",	BTREE_ID_xattrs,  false, bench_hashed_pos, bench_xattr_key },
+	{ "bench_dirents",	BTREE_ID_dirents, false, bench_hashed_pos, bench_dirent_key },
+	{ "bench_extents",	BTREE_ID_extents, false, bench_extent_pos, bench_extent_key },
+	{ "bench_inodes",	BTREE_ID_inodes,  false, bench_inode_pos,  bench_inode_key },
+	{ "bench_write_buffer",	BTREE_ID_lru,	  true,	 bench_lru_pos,	   bench_lru_key },
+};
+
+static unsigned bench_iter_flags(const struct bench_opts *opts)
+{
+	return opts->cached ? BTREE_ITER_CACHED : 0;
+}
+
+static int bench_read(struct btree_trans *trans, const struct bench_workload *w,
+		      const struct bench_opts *opts, u64 key)
+{
+	struct btree_iter iter;
+	struct bkey_s_c k = bch2_bkey_get_iter(trans, &iter, w->btree,
+				w->pos(&bench_profiles[opts->profile], key),
+				bench_iter_flags(opts));
+	int ret = bkey_err(k);
+
+	bch2_trans_iter_exit(trans, &iter);
+	return ret;
+}
+
+static int bench_write(struct btree_trans *trans, const struct bench_workload *w,
+		       const struct bench_opts *opts, u64 key)
+{
+	struct bkey_i *k = w->key(trans, &bench_profiles[opts->profile], key);
+	struct btree_iter iter;
+	int ret = PTR_ERR_OR_ZERO(k);
+
+	if (ret)
+		return ret;
+
+	if (w->buffered)
+		return bch2_trans_update_buffered(trans, w->btree, k);
+
+	bch2_trans_iter_init(trans, &iter, w->btree, bkey_start_pos(&k->k),
+			     BTREE_ITER_INTENT|bench_iter_flags(opts));
+	ret   = bch2_btree_iter_traverse(&iter) ?:
+		bch2_trans_update(trans, &iter, k, 0);
+	bch2_trans_iter_exit(trans, &iter);
+	return ret;
+}
+
+/* Delete exactly the keys the benchmark could have created, [0, @nr): */
+static int bench_cleanup(struct bch_fs *c, const struct bench_workload *w,
+			 const struct bench_opts *opts, u64 nr)
+{
+	struct bpos start	= w->pos(&bench_profiles[opts->profile], 0);
+	struct bpos end		= w->pos(&bench_profiles[opts->profile], nr);
+	int ret = 0;
+
+	/* Get keys out of the write buffer and key cache and into the btree: */
+	if (w->buffered)
+		ret = bch2_trans_run(c, bch2_btree_write_buffer_flush_sync(trans));
+	if (!ret && btree_id_cached(c, w->btree))
+		ret = bch2_journal_flush_all_pins(&c->journal);
+
+	return ret ?: bch2_btree_delete_range(c, w->btree, start, end, 0, NULL);
+}
+
+/* Report the highest latency in the bucket each percentile lands in: */
+static void bench_latency_to_text(struct printbuf *out, const char *op,
+				  const u64 *buckets)
+{
+	static const struct {
+		const char	*name;
+		unsigned	per_mille;
+	} pcts[] = {
+		{ "p50",	500 },
+		{ "p90",	900 },
+		{ "p99",	990 },
+		{ "p999",	999 },
+		{ "max",	1000 },
+	};
+	u64 total = 0, seen = 0;
+	unsigned i, idx = 0;
+
+	for (i = 0; i < TIME_STATS_HIST_NR; i++)
+		total += buckets[i];
+	if (!total)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(pcts); i++) {
+		u64 target = max_t(u64, 1, DIV_ROUND_UP_ULL(total * pcts[i].per_mille, 1000));
+
+		while (seen + buckets[idx] < target)
+			seen += buckets[idx++];
+
+		prt_printf(out, " %s_%s_ns=%llu", op, pcts[i].name,
+			   idx + 1 < TIME_STATS_HIST_NR
+			   ? time_stats_hist_bucket_start(idx + 1) - 1
+			   : time_stats_hist_bucket_start(idx));
+	}
+}
+
 typedef int (*perf_test_fn)(struct bch_fs *, u64);
 
 struct test_job {
 	struct bch_fs			*c;
+	const char			*name;
 	u64				nr;
 	unsigned			nr_threads;
 	perf_test_fn			fn;
+	const struct bench_workload	*bench;
+	struct bench_opts		opts;
+	struct time_stats		lookup_latency;
+	struct time_stats		update_latency;
+
+	atomic_t			thread_idx;
 
 	atomic_t			ready;
 	wait_queue_head_t		ready_wait;
@@ -773,10 +1236,56 @@ struct test_job {
 	int				ret;
 };
 
+static int bench_prefill(struct test_job *j, unsigned idx)
+{
+	u64 nr = div64_u64(j->nr, j->nr_threads), base = nr * idx, i;
+	struct btree_trans *trans = bch2_trans_get(j->c);
+	int ret = 0;
+
+	for (i = 0; i < nr && !ret; i++)
+		ret = commit_do(trans, NULL, NULL, 0,
+			bench_write(trans, j->bench, &j->opts, base + i));
+
+	bch2_trans_put(trans);
+	return ret;
+}
+
+static int bench_run(struct test_job *j, unsigned idx)
+{
+	u64 nr = div64_u64(j->nr, j->nr_threads), base = nr * idx, i;
+	struct btree_trans *trans = bch2_trans_get(j->c);
+	int ret = 0;
+
+	for (i = 0; i < nr; i++) {
+		u64 key = i, start;
+		bool read = get_random_u32_below(100) < j->opts.read_pct;
+
+		if (!j->opts.seq)
+			div64_u64_rem(test_rand(), nr, &key);
+		key += base;
+
+		start = local_clock();
+		ret = read
+			? lockrestart_do(trans, bench_read(trans, j->bench, &j->opts, key))
+			: commit_do(trans, NULL, NULL, 0,
+				bench_write(trans, j->bench, &j->opts, key));
+		if (ret)
+			break;
+		time_stats_update(read ? &j->lookup_latency : &j->update_latency, start);
+	}
+
+	bch2_trans_put(trans);
+	return ret;
+}
+
 static int btree_perf_test_thread(void *data)
 {
 	struct test_job *j = data;
-	int ret;
+	unsigned idx = atomic_inc_return(&j->thread_idx) - 1;
+	int ret = 0;
+
+	if (j->bench && j->opts.read_pct)
+		ret = bench_prefill(j, idx);
 
 	if (atomic_dec_and_test(&j->ready)) {
 		wake_up(&j->ready_wait);
@@ -785,9 +1294,12 @@ static int btree_perf_test_thread(void *data)
 		wait_event(j->ready_wait, !atomic_read(&j->ready));
 	}
 
-	ret = j->fn(j->c, div64_u64(j->nr, j->nr_threads));
+	if (!ret)
+		ret = j->bench
+			? bench_run(j, idx)
+			: j->fn(j->c, div64_u64(j->nr, j->nr_threads));
 	if (ret) {
-		bch_err(j->c, "%ps: error %s", j->fn, bch2_err_str(ret));
+		bch_err(j->c, "%s: error %s", j->name, bch2_err_str(ret));
 		j->ret = ret;
 	}
 
@@ -799,15 +1311,118 @@ static int btree_perf_test_thread(void *data)
 	return 0;
 }
 
+/*
+ * Results are kept as one line per run, of space separated key=value pairs, so
+ * they can be scraped from debugfs and compared across kernels:
+ */
+static void perf_test_result(struct bch_fs *c, struct test_job *j, u64 time)
+{
+	struct printbuf *out = &c->perf_test_results;
+	u64 *lookup = NULL, *update = NULL;
+
+	if (j->bench) {
+		lookup = kmalloc_array(TIME_STATS_HIST_NR, sizeof(u64), GFP_KERNEL);
+		if (lookup && !time_stats_hist_read(&j->lookup_latency, lookup)) {
+			kfree(lookup);
+			lookup = NULL;
+		}
+
+		update = kmalloc_array(TIME_STATS_HIST_NR, sizeof(u64), GFP_KERNEL);
+		if (update && !time_stats_hist_read(&j->update_latency, update)) {
+			kfree(update);
+			update = NULL;
+		}
+	}
+
+	mutex_lock(&c->perf_test_lock);
+	prt_printf(out, "test=%s kernel=%s nr=%llu threads=%u pin=%u ns=%llu ops_per_sec=%llu",
+		   j->name, init_utsname()->release, j->nr, j->nr_threads, j->opts.pin,
+		   time, div64_u64(j->nr * NSEC_PER_SEC, time));
+
+	if (j->bench)
+		prt_printf(out, " profile=%s read_pct=%u seq=%u cached=%u",
+			   bench_profile_strs[j->opts.profile],
+			   j->opts.read_pct, j->opts.seq, j->opts.cached);
+	if (lookup)
+		bench_latency_to_text(out, "lookup", lookup);
+	if (update)
+		bench_latency_to_text(out, "update", update);
+	prt_newline(out);
+	mutex_unlock(&c->perf_test_lock);
+
+	kfree(update);
+	kfree(lookup);
+}
+
+void bch2_perf_test_results_to_text(struct printbuf *out, struct bch_fs *c)
+{
+	mutex_lock(&c->perf_test_lock);
+	if (c->perf_test_results.pos)
+		prt_str(out, c->perf_test_results.buf);
+	mutex_unlock(&c->perf_test_lock);
+}
+
+void bch2_perf_test_results_reset(struct bch_fs *c)
+{
+	mutex_lock(&c->perf_test_lock);
+	printbuf_reset(&c->perf_test_results);
+	mutex_unlock(&c->perf_test_lock);
+}
+
+static int perf_test_start_threads(struct test_job *j)
+{
+	struct task_struct **threads;
+	unsigned i;
+	int ret = 0;
+
+	threads = kcalloc(j->nr_threads, sizeof(threads[0]), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (i = 0; i < j->nr_threads; i++) {
+		threads[i] = j->opts.pin
+			? kthread_create_on_cpu(btree_perf_test_thread, j,
+					cpumask_nth(i % num_online_cpus(), cpu_online_mask),
+					"bcachefs perf test/%u")
+			: kthread_create(btree_perf_test_thread, j,
+					 "bcachefs perf test[%u]", i);
+		if (IS_ERR(threads[i])) {
+			ret = PTR_ERR(threads[i]);
+			while (i--)
+				kthread_stop(threads[i]);
+			goto out;
+		}
+	}
+
+	for (i = 0; i < j->nr_threads; i++)
+		wake_up_process(threads[i]);
+out:
+	kfree(threads);
+	return ret;
+}
+
 int bch2_btree_perf_test(struct bch_fs *c, const char *testname,
-			 u64 nr, unsigned nr_threads)
+			 u64 nr, unsigned nr_threads, char *opts)
 {
-	struct test_job j = { .c = c, .nr = nr, .nr_threads = nr_threads };
+	struct test_job j = {
+		.c		= c,
+		.name		= testname,
+		.nr		= nr,
+		.nr_threads	= nr_threads,
+	};
 	char name_buf[20];
 	struct printbuf nr_buf = PRINTBUF;
 	struct printbuf per_sec_buf = PRINTBUF;
 	unsigned i;
 	u64 time;
+	int ret;
+
+	if (!nr_threads)
+		return -EINVAL;
+
+	ret = bench_opts_parse(&j.opts, opts);
+	if (ret)
+		return ret;
 
 	atomic_set(&j.ready, nr_threads);
 	init_waitqueue_head(&j.ready_wait);
@@ -829,6 +1444,10 @@ int bch2_btree_perf_test(struct bch_fs *c, const char *testname,
 	perf_test(seq_overwrite);
 	perf_test(seq_delete);
 
+	perf_test(str_hash_stream_perf);
+	perf_test(str_hash_perf);
+	perf_test(str_hash_multi_perf);
+
 	/* a unit test, not a perf test: */
 	perf_test(test_delete);
 	perf_test(test_delete_written);
@@ -847,24 +1466,56 @@ int bch2_btree_perf_test(struct bch_fs *c, const char *testname,
 
 	perf_test(test_snapshots);
 
-	if (!j.fn) {
+	perf_test(test_str_hash);
+
+	for (i = 0; i < ARRAY_SIZE(bench_workloads); i++)
+		if (!strcmp(testname, bench_workloads[i].name))
+			j.bench = &bench_workloads[i];
+
+	if (!j.fn && !j.bench) {
 		pr_err("unknown test %s", testname);
 		return -EINVAL;
 	}
 
+	/* Only pinning applies to the old style perf tests: */
+	if (!j.bench &&
+	    (j.opts.profile || j.opts.read_pct || j.opts.seq || j.opts.cached)) {
+		pr_err("test %s doesn't take benchmark options", testname);
+		return -EINVAL;
+	}
+
+	time_stats_init(&j.lookup_latency);
+	time_stats_init(&j.update_latency);
+	if (j.bench) {
+		ret =   time_stats_hist_enable(&j.lookup_latency) ?:
+			time_stats_hist_enable(&j.update_latency);
+		if (ret)
+			goto err;
+	}
+
 	//pr_info("running test %s:", testname);
 
-	if (nr_threads == 1)
+	if (nr_threads == 1 && !j.opts.pin) {
 		btree_perf_test_thread(&j);
-	else
-		for (i = 0; i < nr_threads; i++)
-			kthread_run(btree_perf_test_thread, &j,
-				    "bcachefs perf test[%u]", i);
+	} else {
+		ret = perf_test_start_threads(&j);
+		if (ret)
+			goto err;
+	}
 
 	while (wait_for_completion_interruptible(&j.done_completion))
 		;
 
-	time = j.finish - j.start;
+	time = max_t(u64, j.finish - j.start, 1);
+
+	if (j.bench) {
+		ret = bench_cleanup(c, j.bench, &j.opts, j.nr);
+		bch_err_msg(c, ret, "cleaning up after %s", testname);
+		j.ret = j.ret ?: ret;
+	}
+
+	if (!j.ret)
+		perf_test_result(c, &j, time);
 
 	scnprintf(name_buf, sizeof(name_buf), "%s:", testname);
 	prt_human_readable_u64(&nr_buf, nr);
@@ -876,7 +1527,22 @@ int bch2_btree_perf_test(struct bch_fs *c, const char *testname,
 		per_sec_buf.buf);
 	printbuf_exit(&per_sec_buf);
 	printbuf_exit(&nr_buf);
-	return j.ret;
+	ret = j.ret;
+err:
+	time_stats_exit(&j.update_latency);
+	time_stats_exit(&j.lookup_latency);
+	return ret;
+}
+
+void bch2_fs_tests_exit(struct bch_fs *c)
+{
+	printbuf_exit(&c->perf_test_results);
+}
+
+void bch2_fs_tests_init_early(struct bch_fs *c)
+{
+	mutex_init(&c->perf_test_lock);
+	c->perf_test_results = PRINTBUF;
 }
 
 #endif /* CONFIG_BCACHEFS_TESTS */
@@ -6,10 +6,21 @@ struct bch_fs;
 
 #ifdef CONFIG_BCACHEFS_TESTS
 
-int bch2_btree_perf_test(struct bch_fs *, const char *, u64, unsigned);
+struct printbuf;
+
+int bch2_btree_perf_test(struct bch_fs *, const char *, u64, unsigned, char *);
+
+void bch2_perf_test_results_to_text(struct printbuf *, struct bch_fs *);
+void bch2_perf_test_results_reset(struct bch_fs *);
+
+void bch2_fs_tests_exit(struct bch_fs *);
+void bch2_fs_tests_init_early(struct bch_fs *);
 
 #else
 
+static inline void bch2_fs_tests_exit(struct bch_fs *c) {}
+static inline void bch2_fs_tests_init_early(struct bch_fs *c) {}
+
 #endif /* CONFIG_BCACHEFS_TESTS */
 
 #endif /* _BCACHEFS_TEST_H */
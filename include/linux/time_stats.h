@@ -24,6 +24,7 @@
 #ifndef _LINUX_TIME_STATS_H
 #define _LINUX_TIME_STATS_H
 
+#include <linux/bitops.h>
 #include <linux/mean_and_variance.h>
 #include <linux/sched/clock.h>
 #include <linux/spinlock_types.h>
@@ -66,6 +67,54 @@ struct time_stat_buffer {
 	}		entries[31];
 };
 
+/*
+ * Optional log-linear (HDR style) histogram of event durations, for computing
+ * exact percentiles from outside the kernel: durations are bucketed by power of
+ * two, and each power of two is split into TIME_STATS_HIST_SUB linear
+ * sub-buckets, so the relative error of a bucket is at most
+ * 1/TIME_STATS_HIST_SUB. Durations of 2^TIME_STATS_HIST_MAX_BITS ns (~18
+ * minutes) and up all land in the last bucket.
+ *
+ * Counters are percpu and recorded without taking the time_stats lock.
+ */
+#define TIME_STATS_HIST_SUB_BITS	3
+#define TIME_STATS_HIST_SUB		(1U << TIME_STATS_HIST_SUB_BITS)
+#define TIME_STATS_HIST_MAX_BITS	40
+#define TIME_STATS_HIST_NR		\
+	((TIME_STATS_HIST_MAX_BITS - TIME_STATS_HIST_SUB_BITS + 1) << TIME_STATS_HIST_SUB_BITS)
+
+struct time_stats_hist {
+	u64		buckets[TIME_STATS_HIST_NR];
+};
+
+static inline unsigned time_stats_hist_idx(u64 v)
+{
+	unsigned e;
+
+	if (v < TIME_STATS_HIST_SUB)
+		return v;
+
+	e = fls64(v) - 1;
+	if (e >= TIME_STATS_HIST_MAX_BITS)
+		return TIME_STATS_HIST_NR - 1;
+
+	return ((e - TIME_STATS_HIST_SUB_BITS + 1) << TIME_STATS_HIST_SUB_BITS) |
+		((v >> (e - TIME_STATS_HIST_SUB_BITS)) & (TIME_STATS_HIST_SUB - 1));
+}
+
+/* Smallest duration, in ns, that lands in bucket @idx: */
+static inline u64 time_stats_hist_bucket_start(unsigned idx)
+{
+	unsigned e;
+
+	if (idx < TIME_STATS_HIST_SUB)
+		return idx;
+
+	e = (idx >> TIME_STATS_HIST_SUB_BITS) + TIME_STATS_HIST_SUB_BITS - 1;
+	return (u64) (TIME_STATS_HIST_SUB | (idx & (TIME_STATS_HIST_SUB - 1))) <<
+		(e - TIME_STATS_HIST_SUB_BITS);
+}
+
 struct time_stats {
 	spinlock_t	lock;
 	bool		have_quantiles;
@@ -87,6 +136,7 @@ struct time_stats {
 	struct mean_and_variance_weighted duration_stats_weighted;
 	struct mean_and_variance_weighted freq_stats_weighted;
 	struct time_stat_buffer __percpu *buffer;
+	struct time_stats_hist __percpu *hist;
 
 	u64		start_time;
 };
@@ -150,6 +200,9 @@ void time_stats_to_seq_buf(struct seq_buf *, struct time_stats *,
 void time_stats_to_json(struct seq_buf *, struct time_stats *,
 		const char *epoch_name, unsigned int flags);
 
+int time_stats_hist_enable(struct time_stats *);
+bool time_stats_hist_read(struct time_stats *, u64 *);
+
 void time_stats_exit(struct time_stats *);
 void time_stats_init(struct time_stats *);
 
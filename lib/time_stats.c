@@ -123,6 +123,10 @@ static noinline void time_stats_clear_buffer(struct time_stats *stats,
 void __time_stats_update(struct time_stats *stats, u64 start, u64 end)
 {
 	unsigned long flags;
+	struct time_stats_hist __percpu *hist = READ_ONCE(stats->hist);
+
+	if (hist && time_after64(end, start))
+		this_cpu_inc(hist->buckets[time_stats_hist_idx(end - start)]);
 
 	if (!stats->buffer) {
 		spin_lock_irqsave(&stats->lock, flags);
@@ -353,8 +357,64 @@ void time_stats_to_json(struct seq_buf *out, struct time_stats *stats,
 }
 EXPORT_SYMBOL_GPL(time_stats_to_json);
 
+/**
+ * time_stats_hist_enable - start recording a histogram of event durations
+ *
+ * @stats	- time_stats to record a histogram for
+ *
+ * Histograms cost TIME_STATS_HIST_NR u64s of percpu memory, so they're only
+ * recorded for time_stats that have asked for them; once enabled, they stay
+ * enabled until time_stats_exit().
+ */
+int time_stats_hist_enable(struct time_stats *stats)
+{
+	struct time_stats_hist __percpu *hist;
+
+	if (READ_ONCE(stats->hist))
+		return 0;
+
+	hist = alloc_percpu(struct time_stats_hist);
+	if (!hist)
+		return -ENOMEM;
+
+	if (cmpxchg(&stats->hist, NULL, hist))
+		free_percpu(hist);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(time_stats_hist_enable);
+
+/**
+ * time_stats_hist_read - sum up a time_stats histogram
+ *
+ * @stats	- time_stats to read
+ * @buckets	- array of TIME_STATS_HIST_NR u64s to fill in
+ *
+ * Returns false if histograms aren't enabled for @stats.
+ */
+bool time_stats_hist_read(struct time_stats *stats, u64 *buckets)
+{
+	struct time_stats_hist __percpu *hist = READ_ONCE(stats->hist);
+	int cpu;
+
+	if (!hist)
+		return false;
+
+	memset(buckets, 0, sizeof(u64) * TIME_STATS_HIST_NR);
+
+	for_each_possible_cpu(cpu) {
+		struct time_stats_hist *h = per_cpu_ptr(hist, cpu);
+
+		for (unsigned i = 0; i < TIME_STATS_HIST_NR; i++)
+			buckets[i] += READ_ONCE(h->buckets[i]);
+	}
+
+	return true;
+}
+EXPORT_SYMBOL_GPL(time_stats_hist_read);
+
 void time_stats_exit(struct time_stats *stats)
 {
+	free_percpu(stats->hist);
 	free_percpu(stats->buffer);
 }
 EXPORT_SYMBOL_GPL(time_stats_exit);